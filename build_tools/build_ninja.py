@@ -182,7 +182,8 @@ def build_shader_code_generate(ninja_writer: ninja.Writer, shader_files):
     rule=pub.ninja.shader_code_total_rule,
     outputs=pub.path.shader_code_all_file,
   )
-  return sources + [(pub.path.shader_code_all_file, False)]
+  result = sp.run(' '.join(['python', pub.path.shader_generate_script, '--task', 'total_module', '-c'] + shader_files), stdout=sp.PIPE).stdout
+  return sources + [(pub.path.shader_code_all_file, result.decode('utf-8').strip())]
 
 class NinjaWriterContextManager(ninja.Writer):
   def __enter__(self):
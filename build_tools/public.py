@@ -38,7 +38,7 @@ class Paths:
     self.shader_generate_script = ospath.join(self.build_tools_dir, 'shader_code_generate.py')
 
     self.gen_dir = ospath.join(self.build_dir, 'gen')
-    self.shader_code_all_file = ospath.join(self.gen_dir, 'shader_code.cc')
+    self.shader_code_all_file = ospath.join(self.gen_dir, 'shader_code.ccm')
 
   # 得到相对root_dir的路径
   def get_rel_root_path(self, path):
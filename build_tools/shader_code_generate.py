@@ -1,6 +1,6 @@
 import os.path as ospath
 import argparse
-import subprocess as sp 
+import subprocess as sp
 
 parser = argparse.ArgumentParser()
 parser.add_argument('--task', type=str, dest='task', required=True)
@@ -8,40 +8,76 @@ parser.add_argument('-c', type=str, dest='input', nargs='+', required=True)
 parser.add_argument('-o', type=str, dest='output', required=False)
 args = parser.parse_args()
 
+registry_module = 'shader_code.registry'
+
 def get_shader_identify(shader_file):
   return ospath.basename(shader_file).replace('.', '_')
 
+# 与 render.vk.shader_code 中的 shader_name_hash 保持一致 (FNV-1a 32 bit, 以 seed 扰动初值)
+def shader_name_hash(name, seed):
+  h = 0x811c9dc5 ^ seed
+  for b in name.encode('utf-8'):
+    h ^= b
+    h = (h * 0x01000193) & 0xffffffff
+  return h
+
+# 寻找无冲突的 seed, 得到完美哈希表, 表大小为 2 的幂
+def find_perfect_hash(names):
+  size = 1
+  while size < len(names) * 2:
+    size *= 2
+  while True:
+    for seed in range(1 << 16):
+      slots = [shader_name_hash(name, seed) & (size - 1) for name in names]
+      if len(set(slots)) == len(slots):
+        return seed, size, slots
+    size *= 2
+
 if args.task == 'total':
+  names = [ospath.basename(shader_file) for shader_file in args.input]
+  if len(set(names)) != len(names):
+    raise RuntimeError(f'duplicate shader names: {names}')
+  seed, size, slots = find_perfect_hash(names)
   import_decl = ''
-  pair_decl = ''
-  for shader_file in args.input:
-    import_decl += f'import shader_code.{get_shader_identify(shader_file)};\n'
-    pair_decl += f'{{"{ospath.basename(shader_file)}", std::as_bytes(std::span{{shader_code::{get_shader_identify(shader_file)}::shader_code_data}})}},\n'
-  code = f'''module render.vk.shader_code;
+  entries = ['{}'] * size
+  for shader_file, name, slot in zip(args.input, names, slots):
+    identify = get_shader_identify(shader_file)
+    import_decl += f'import shader_code.{identify};\n'
+    entries[slot] = f'{{"{name}", shader_code::{identify}::shader_code_data}}'
+  entry_decl = ',\n'.join(entries)
+  code = f'''export module {registry_module};
           import std;
           {import_decl}
-          namespace rd::vk{{
-          auto get_shader_code(std::string_view shader) -> std::span<const std::byte> {{
-            auto shader_code_map = std::map<std::string_view, std::span<const std::byte>> {{
-              {pair_decl}
-            }};
-            return shader_code_map.at(shader);
-          }}
+          export namespace shader_code::registry{{
+          struct Entry {{
+            std::string_view                name;
+            std::span<const std::uint32_t> code;
+          }};
+          inline constexpr auto seed = std::uint32_t{{ {seed} }};
+          inline constexpr auto table = std::array<Entry, {size}>{{
+            {entry_decl}
+          }};
           }}'''
   with open(args.output, 'wt') as f:
     f.write(code)
 elif args.task == 'single':
   shader_file = args.input[0]
   shader_codes = sp.run(f'glslc {shader_file} -o -', check=True, stdout=sp.PIPE).stdout
+  if len(shader_codes) % 4 != 0:
+    raise RuntimeError(f'the SPIR-V of {shader_file} is not composed of 32 bit words')
+  # SPIR-V 按小端 32 位字保存, 直接生成 uint32 数组, 可以不经转换地作为 pCode
+  words = [int.from_bytes(shader_codes[i:i + 4], 'little') for i in range(0, len(shader_codes), 4)]
   code =  f'''export module shader_code.{get_shader_identify(shader_file)};
               import std;
               export namespace shader_code::{get_shader_identify(shader_file)}{{
-                auto shader_code_data = std::array<const unsigned char, {len(shader_codes)}>{{
-                  {str(list(shader_codes))[1:-1]}
+                alignas(4) inline constexpr auto shader_code_data = std::array<const std::uint32_t, {len(words)}>{{
+                  {', '.join(hex(word) for word in words)}
                 }};
               }}'''
   with open(args.output, 'wt') as f:
     f.write(code)
 elif args.task == 'module':
   shader_file = args.input[0]
-  print(f"shader_code.{get_shader_identify(shader_file)}")
\ No newline at end of file
+  print(f"shader_code.{get_shader_identify(shader_file)}")
+elif args.task == 'total_module':
+  print(registry_module)
@@ -0,0 +1,15 @@
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+// windows头文件中定义的逆天宏
+#undef near
+#undef far
+#undef DELETE
+#undef interface
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
\ No newline at end of file
@@ -0,0 +1,5 @@
+// x86-64 always has SSE2, AVX is selected at run time by the functions with target("avx")
+#if defined(__x86_64__) || defined(_M_X64)
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
\ No newline at end of file
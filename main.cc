@@ -6,13 +6,19 @@ import "vulkan_config.h";
 import "glfw_config.h";
 import render.vk.instance;
 import render.vk.device;
+import render.vk.allocator;
 import render.vk.surface;
 import render.vk.resource;
 import render.vk.executor;
 import render.vk.queue_requestor;
 import render.vk.image;
 import render.vk.render_pass;
+import render.vk.render_graph;
 import render.vk.buffer;
+import render.vk.uniform;
+import render.vk.upload;
+import render.vk.culling;
+import render.mesh_pool;
 import render.vk.presentation;
 import render.context;
 import render.vk.sync;
@@ -24,9 +30,14 @@ import input;
 import model;
 import glfw;
 import transform;
+import culling;
 
-int main() {
+int main(int argc, char** argv) {
   try {
+    // the benches take seconds, they run only when asked by --bench
+    auto args = std::span{ argv, static_cast<size_t>(argc) } |
+                views::transform([](char const* arg) { return std::string_view{ arg }; });
+    auto run_benches = ranges::find(args, "--bench") != args.end();
     json::test_json();
     toy::test_EnumerateAdaptor();
     toy::test_SortedRange();
@@ -34,7 +45,25 @@ int main() {
     toy::test_Generator::test();
     toy::test_EnumSet::test();
     trans::test_trans();
+    rd::vk::test_TlsfAllocator::test();
+    if (run_benches) {
+      rd::vk::test_TlsfAllocator::bench();
+    }
+    cull::test_FrustumCulling::test();
+    if (run_benches) {
+      cull::test_FrustumCulling::bench();
+    }
     auto  ctx = rd::Context{ "hello vulkan", 1920, 1080 };
+    // the parser runs on the thread pool of context
+    model::test_ObjParser::test();
+    if (run_benches) {
+      model::test_ObjParser::bench();
+    }
+    model::test_MeshOptimizer::test();
+    if (run_benches) {
+      model::test_MeshOptimizer::bench();
+    }
+    rd::test_MeshPool::test();
     auto& input_processor = input::InputProcessor::getInstance();
 
     auto depth_format = VK_FORMAT_D32_SFLOAT;
@@ -88,207 +117,179 @@ int main() {
           .vertex_shader_name = "hello.vert",
           .frag_shader_name = "hello.frag",
           .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
-          .vertex_info = model::Vertex::getVertexInfo(),
-          .descriptor_sets = {
-            rd::vk::DescriptorSetInfo{
-              .descriptors = {
-                rd::vk::DescriptorInfo{
-                  .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                  .stage = VK_SHADER_STAGE_VERTEX_BIT,
-                  .count = 1,
-                },
-              },
-            },
-            rd::vk::DescriptorSetInfo{
-              .descriptors = {
-                rd::vk::DescriptorInfo{
-                  .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                  .stage = VK_SHADER_STAGE_VERTEX_BIT,
-                  .count = 1,
-                },
-                rd::vk::DescriptorInfo{
-                  .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-                  .stage = VK_SHADER_STAGE_VERTEX_BIT,
-                  .count = 1,
-                },
-              },
-            },
-            rd::vk::DescriptorSetInfo{
-              .descriptors = {rd::vk::DescriptorInfo{
-                  .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-                  .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-                  .count = 1,
-              }},
-            },
-          },
+          .vertex_info = model::CompressedVertex::getVertexInfo(),
+          // view and proj are allocated from the uniform ring every frame
+          .dynamic_uniforms = { { 0, 0 }, { 0, 1 } },
+          // the model matrix of each draw
+          .push_constants = { { VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(glm::mat4) } },
         },
       },
     };
 
     auto model_data = trans::model::create(glm::vec3{ 0.0f, 0.0f, 0.0f });
     // model_data = model_data * trans::rotate<trans::Axis::Z>(90.0f);
-    auto model_uniform = rd::vk::UniformBuffer{ model_data };
     auto view_data = trans::view::create(glm::vec3{ 5.0f, 5.0f, 5.0f });
-    auto view_uniform = rd::vk::UniformBuffer{ view_data };
     auto proj_data = trans::proj::perspective({
       .width = swapchain.getExtent().width,
       .height = swapchain.getExtent().height,
     });
-    auto proj_uniform = rd::vk::UniformBuffer{ proj_data };
-    auto sampled_texture =
-      rd::SampledTexture{ "model/viking_room.png", true, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT };
-    auto [vertexes, indices] = model::getModelInfo("model/viking_room.obj");
-    auto vertex_buffer = rd::VertexBuffer{ vertexes };
-    auto index_buffer = rd::IndexBuffer{ indices };
+    auto upload_batch = rd::vk::UploadBatch{};
+    // the mapped vertices and indices are copied to the staging memory directly
+    auto mesh = model::loadModel<model::CompressedVertex>("model/viking_room.obj");
+    // every mesh is sub-allocated from the shared buffers, which are bound once per pass
+    auto mesh_pool = rd::MeshPool{ model::CompressedVertex::getVertexInfo(), 1 << 20, 1 << 22 };
+    auto model_mesh = std::visit(
+      [&](auto indices) { return mesh_pool.add(mesh.getVertices(), indices, upload_batch); },
+      mesh.getIndices()
+    );
+    auto bounding_sphere = mesh.getBoundingSphere();
+    auto materials = mesh.getMaterials();
+    // the materials without diffuse texture use the texture shipped with the model
+    auto textures = materials | views::transform([&](auto const& material) {
+                      auto path = material.diffuse_texture.empty() ? "model/viking_room.png"
+                                                                   : material.diffuse_texture;
+                      return rd::SampledTexture{
+                        path, true, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, upload_batch
+                      };
+                    }) |
+                    ranges::to<std::vector>();
+    // each batch is drawn only if the bounding sphere of model intersects the frustum, a batch
+    // is a group of the culling since it is drawn after binding its material, the objects of
+    // the selected lod are culled by one dispatch
+    auto batches = mesh.getBatches();
+    auto lods = mesh.getLods();
+    auto world_center = model_data * glm::vec4{ glm::vec3{ bounding_sphere }, 1.0f };
+    auto batch_count = static_cast<uint32>(batches.size());
+    auto culling = rd::vk::GpuCulling{ batch_count, batch_count };
+    auto cull_objects = views::iota(0u, batch_count) | views::transform([&](uint32 i) {
+                          return rd::vk::CullObject{
+                            .bounding_sphere = { glm::vec3{ world_center }, bounding_sphere.w },
+                            .index_count = batches[i].index_count,
+                            .first_index = model_mesh.first_index + batches[i].first_index,
+                            .vertex_offset = model_mesh.vertex_offset,
+                            .instance = 0,
+                            .group = i,
+                          };
+                        }) |
+                        ranges::to<std::vector>();
+    culling.setObjects(cull_objects, upload_batch);
+    upload_batch.submit();
 
     auto render_pass = rd::vk::RenderPass{ render_pass_info };
     auto dset_pool = rd::vk::DescriptorPool{
-      3,
+      static_cast<uint32>(1 + materials.size()),
       std::vector{
-        VkDescriptorPoolSize{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3 },
-        VkDescriptorPoolSize{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 },
+        VkDescriptorPoolSize{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 2 },
+        VkDescriptorPoolSize{
+          VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, static_cast<uint32>(materials.size()) },
       }
     };
-    auto dset_model = rd::vk::DescriptorSet{ dset_pool, render_pass[0], 0 };
-    dset_model[0] = model_uniform;
-    auto dset_camera = rd::vk::DescriptorSet{ dset_pool, render_pass[0], 1 };
-    dset_camera[0] = view_uniform;
-    dset_camera[1] = proj_uniform;
-    auto dset_texture = rd::vk::DescriptorSet{ dset_pool, render_pass[0], 2 };
-    dset_texture[0] = sampled_texture;
+    auto& uniform_ring = rd::vk::UniformRing::getInstance();
+    auto  dset_camera = rd::vk::DescriptorSet{ dset_pool, render_pass[0], 0 };
+    dset_camera[0] = uniform_ring.getRange<decltype(view_data)>();
+    dset_camera[1] = uniform_ring.getRange<decltype(proj_data)>();
+    // one set of each material
+    auto dset_materials = textures | views::transform([&](auto const& texture) {
+                            auto dset = rd::vk::DescriptorSet{ dset_pool, render_pass[0], 1 };
+                            dset[0] = texture;
+                            return dset;
+                          }) |
+                          ranges::to<std::vector>();
 
-    struct FramebufferResource {
-      rd::vk::Image                    sample_image;
-      rd::vk::ImageBarrierTracker      sample_image_tracker;
-      rd::vk::Image                    depth_image;
-      rd::vk::ImageBarrierTracker      depth_image_tracker;
-      std::vector<rd::vk::Framebuffer> framebuffers;
-
-      auto operator=(FramebufferResource&& other) = delete;
-
-      void clear() {
-        depth_image_tracker = {};
-        sample_image_tracker = {};
-        framebuffers.clear();
-        depth_image = {};
-        sample_image = {};
-      }
-      ~FramebufferResource() { clear(); }
+    auto clear_values = std::array{
+      VkClearValue{ .color = { .float32 = { 0.5f, 0.5f, 0.5f, 1.0f } } },
+      VkClearValue{ .color = { .float32 = { 1.0f, 1.0f, 1.0f, 1.0f } } },
+      VkClearValue{ .depthStencil = { .depth = 1.0f, } },
     };
-    auto framebuffer_resource = FramebufferResource{};
-    auto createFramebuffers = [&]() {
-      framebuffer_resource.sample_image = rd::vk::Image{
-        swapchain.getFormat(),
-        swapchain.getExtent().width,
-        swapchain.getExtent().height,
-        VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-        VK_IMAGE_ASPECT_COLOR_BIT,
-        1,
-        sample_count,
-      };
-      framebuffer_resource.sample_image_tracker = rd::vk::ImageBarrierTracker{
-        framebuffer_resource.sample_image,
-        rd::vk::getSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT, { 0, 1 }),
-      };
-      framebuffer_resource.depth_image = rd::vk::Image{
-        depth_format,
-        swapchain.getExtent().width,
-        swapchain.getExtent().height,
-        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
-        VK_IMAGE_ASPECT_DEPTH_BIT,
-        1,
-        sample_count,
-      };
-      framebuffer_resource.depth_image_tracker = rd::vk::ImageBarrierTracker{
-        framebuffer_resource.depth_image,
-        rd::vk::getSubresourceRange(VK_IMAGE_ASPECT_DEPTH_BIT, { 0, 1 }),
-      };
-      framebuffer_resource.framebuffers = //
-        swapchain.getImageViews() | views::transform([&](VkImageView image_view) {
-          return rd::vk::Framebuffer{
-            render_pass,
-            swapchain.getExtent(),
-            std::array{
-              framebuffer_resource.sample_image.image_view(),
-              image_view,
-              framebuffer_resource.depth_image.image_view(),
-            },
-          };
-        }) |
-        ranges::to<std::vector>();
+
+    auto render_graph = rd::vk::RenderGraph{};
+    auto backbuffer = rd::vk::ImageHandle{};
+    auto buildRenderGraph = [&]() {
+      auto extent = swapchain.getExtent();
+      // the multi-sample color and depth images are only used inside the render pass, so they are
+      // transient images of the graph
+      auto sample_image = render_graph.createImage({
+        .format = swapchain.getFormat(),
+        .extent = extent,
+        .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        .aspect = VK_IMAGE_ASPECT_COLOR_BIT,
+        .sample_count = sample_count,
+      });
+      auto depth_image = render_graph.createImage({
+        .format = depth_format,
+        .extent = extent,
+        .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+        .aspect = VK_IMAGE_ASPECT_DEPTH_BIT,
+        .sample_count = sample_count,
+      });
+      backbuffer = render_graph.importImage(extent);
+      render_graph.addRenderPass(
+        "forward", render_pass, { sample_image, backbuffer, depth_image }, clear_values
+      );
     };
-    createFramebuffers();
+    buildRenderGraph();
 
     auto createResource = [&]() {
       proj_data = trans::proj::perspective({
         .width = swapchain.getExtent().width,
         .height = swapchain.getExtent().height,
       });
-      proj_uniform.update();
-      createFramebuffers();
+      buildRenderGraph();
     };
 
-    auto clear_values = std::array{
-      VkClearValue{ .color = { .float32 = { 0.5f, 0.5f, 0.5f, 1.0f } } },
-      VkClearValue{ .color = { .float32 = { 1.0f, 1.0f, 1.0f, 1.0f } } },
-      VkClearValue{ .depthStencil = { .depth = 1.0f, } },
-    };
-
-    auto count = 0;
+    auto& executor_manager = rd::vk::CommandExecutorManager::getInstance();
     while (!glfwWindowShouldClose(glfw::Window::getInstance())) {
       input_processor.processInput(16.6);
+      executor_manager.beginFrame();
+      uniform_ring.beginFrame();
       auto res = presentation.prepare();
       // toy::debugf("res: {}", res.has_value());
       if (!res.has_value()) {
         for (auto& image : presentation.getImages()) {
           image.waitIdle();
         }
-        framebuffer_resource.clear();
+        render_graph.reset();
         if (presentation.recreate()) {
           createResource();
         }
       } else {
         auto& context = res.value();
-        auto  recorder = render_pass[0].recorder = [&](rd::vk::Pipeline::Recorder& recorder) {
+        // the data of this frame never overwrites the data read by the frames in flight
+        auto view_offset = uniform_ring.push(view_data);
+        auto proj_offset = uniform_ring.push(proj_data);
+        auto projected_radius = trans::proj::projectedRadius(
+          proj_data,
+          glm::vec3{ view_data * world_center },
+          bounding_sphere.w,
+          swapchain.getExtent().height
+        );
+        auto const& lod = lods[model::selectLod(lods, bounding_sphere.w, projected_radius)];
+        auto lod_batches = views::iota(lod.first_batch, lod.first_batch + lod.batch_count);
+        render_pass[0].prepare = [&](VkCommandBuffer cmdbuf) {
+          auto planes = trans::frustum::planes(proj_data * view_data);
+          // one object for each batch, so the objects of the lod are its batches
+          culling.recordCulling(cmdbuf, planes, lod.first_batch, lod.batch_count);
+        };
+        auto recorder = render_pass[0].recorder = [&](rd::vk::Pipeline::Recorder& recorder) {
           recorder.init();
-          recorder.vertex_buffer = vertex_buffer;
-          recorder.index_buffer = index_buffer;
-          recorder.descriptor_set[0] = dset_model;
-          recorder.descriptor_set[1] = dset_camera;
-          recorder.descriptor_set[2] = dset_texture;
-          recorder.draw();
+          recorder.vertex_buffer = mesh_pool.getVertexBuffer();
+          recorder.index_buffer = mesh_pool.getIndexBuffer();
+          recorder.descriptor_set[0].bind(dset_camera, std::array{ view_offset, proj_offset });
+          recorder.push_constants = model_data;
+          // one bind per material, whatever the number of shapes using it
+          for (auto i : lod_batches) {
+            recorder.descriptor_set[1] = dset_materials[batches[i].material];
+            culling.recordDraw(recorder, i);
+          }
         };
-        render_pass.syncAttachments(
-          std::array{
-            &framebuffer_resource.sample_image_tracker,
-            context.tracker,
-            &framebuffer_resource.depth_image_tracker,
-          },
-          VK_NULL_HANDLE
-        );
-        auto& graphics_executor =
-          rd::vk::CommandExecutorManager::getInstance()[rd::vk::FamilyType::GRAPHICS];
-        graphics_executor.submit([&](auto cmdbuf) {
-          render_pass.recordDraw(
-            cmdbuf, framebuffer_resource.framebuffers[context.image_index], clear_values
-          );
-        });
-        render_pass.updateAttachmentsScope(
-          std::array{
-            &framebuffer_resource.sample_image_tracker,
-            context.tracker,
-            &framebuffer_resource.depth_image_tracker,
-          },
-          graphics_executor.getFamily()
-        );
+        render_graph.setImportedImage(backbuffer, context.tracker, context.image_view);
+        render_graph.execute();
 
-        count++;
-        if (count % 1000 == 0) {
-          toy::debug(count);
-        }
         presentation.present(context.image_index);
         // return 0;
       }
+      executor_manager.endFrame();
+      uniform_ring.endFrame();
     }
   } catch (const std::exception& e) {
     std::print("catch exception at root:\n{}\n", e.what());
@@ -0,0 +1,353 @@
+module render.vk.allocator;
+
+import std;
+import toy;
+
+import "vulkan_config.h";
+import render.vk.tool;
+import render.vk.resource;
+import render.vk.device;
+
+namespace rd::vk {
+
+auto alignUp(uint64 value, uint64 alignment) -> uint64 {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+TlsfAllocator::TlsfAllocator(uint64 size) : _size(size) {
+  for (auto& heads : _free_heads) {
+    ranges::fill(heads, null_node);
+  }
+  insertFree(newNode(0, size));
+}
+
+auto TlsfAllocator::mapping(uint64 size) -> std::pair<uint32, uint32> {
+  if (size < sl_count) {
+    return { 0, static_cast<uint32>(size) };
+  }
+  auto fl = static_cast<uint32>(std::bit_width(size) - 1);
+  auto sl = static_cast<uint32>((size >> (fl - sl_log2)) ^ sl_count);
+  return { fl - sl_log2 + 1, sl };
+}
+
+auto TlsfAllocator::mappingSearch(uint64 size) -> std::pair<uint32, uint32> {
+  if (size >= sl_count) {
+    size += (uint64{ 1 } << (std::bit_width(size) - 1 - sl_log2)) - 1;
+  }
+  return mapping(size);
+}
+
+auto TlsfAllocator::newNode(uint64 offset, uint64 size) -> uint32 {
+  auto node = Node{ .offset = offset, .size = size };
+  if (!_recycled_nodes.empty()) {
+    auto index = _recycled_nodes.back();
+    _recycled_nodes.pop_back();
+    _nodes[index] = node;
+    return index;
+  }
+  _nodes.push_back(node);
+  return static_cast<uint32>(_nodes.size() - 1);
+}
+
+void TlsfAllocator::recycleNode(uint32 node) { _recycled_nodes.push_back(node); }
+
+auto TlsfAllocator::findFree(uint64 size) -> uint32 {
+  auto [fl, sl] = mappingSearch(size);
+  if (fl >= fl_count) {
+    return null_node;
+  }
+  auto sl_map = _sl_bitmaps[fl] & (~uint32{ 0 } << sl);
+  if (sl_map == 0) {
+    auto fl_map = fl + 1 < 64 ? _fl_bitmap & (~uint64{ 0 } << (fl + 1)) : 0;
+    if (fl_map == 0) {
+      return null_node;
+    }
+    fl = std::countr_zero(fl_map);
+    sl_map = _sl_bitmaps[fl];
+  }
+  sl = std::countr_zero(sl_map);
+  return _free_heads[fl][sl];
+}
+
+auto TlsfAllocator::findFit(uint64 size, uint64 alignment) -> uint32 {
+  auto [fl, sl] = mapping(size);
+  auto end = mappingSearch(size + alignment - 1);
+  while (fl < fl_count && std::pair{ fl, sl } < end) {
+    if (_sl_bitmaps[fl] & (uint32{ 1 } << sl)) {
+      for (auto node = _free_heads[fl][sl]; node != null_node; node = _nodes[node].next_free) {
+        auto padding = alignUp(_nodes[node].offset, alignment) - _nodes[node].offset;
+        if (padding + size <= _nodes[node].size) {
+          return node;
+        }
+      }
+    }
+    if (++sl == sl_count) {
+      fl++;
+      sl = 0;
+    }
+  }
+  return null_node;
+}
+
+void TlsfAllocator::insertFree(uint32 node) {
+  auto& info = _nodes[node];
+  auto [fl, sl] = mapping(info.size);
+  auto& head = _free_heads[fl][sl];
+  info.free = true;
+  info.prev_free = null_node;
+  info.next_free = head;
+  if (head != null_node) {
+    _nodes[head].prev_free = node;
+  }
+  head = node;
+  _sl_bitmaps[fl] |= uint32{ 1 } << sl;
+  _fl_bitmap |= uint64{ 1 } << fl;
+}
+
+void TlsfAllocator::removeFree(uint32 node) {
+  auto& info = _nodes[node];
+  auto [fl, sl] = mapping(info.size);
+  auto& head = _free_heads[fl][sl];
+  if (info.prev_free != null_node) {
+    _nodes[info.prev_free].next_free = info.next_free;
+  }
+  if (info.next_free != null_node) {
+    _nodes[info.next_free].prev_free = info.prev_free;
+  }
+  if (head == node) {
+    head = info.next_free;
+    if (head == null_node) {
+      _sl_bitmaps[fl] &= ~(uint32{ 1 } << sl);
+      if (_sl_bitmaps[fl] == 0) {
+        _fl_bitmap &= ~(uint64{ 1 } << fl);
+      }
+    }
+  }
+  info.free = false;
+  info.prev_free = null_node;
+  info.next_free = null_node;
+}
+
+auto TlsfAllocator::split(uint32 node, uint64 size) -> uint32 {
+  // newNode() may reallocate _nodes, so do not hold reference across it
+  auto rest = newNode(_nodes[node].offset + size, _nodes[node].size - size);
+  auto next = _nodes[node].next_phys;
+  _nodes[rest].prev_phys = node;
+  _nodes[rest].next_phys = next;
+  if (next != null_node) {
+    _nodes[next].prev_phys = rest;
+  }
+  _nodes[node].next_phys = rest;
+  _nodes[node].size = size;
+  return rest;
+}
+
+auto TlsfAllocator::allocate(uint64 size, uint64 alignment) -> std::optional<Allocation> {
+  size = std::max(size, uint64{ 1 });
+  alignment = std::max(alignment, uint64{ 1 });
+  // search with the worst case padding, so that the found range can always hold the allocation
+  auto node = findFree(size + alignment - 1);
+  if (node == null_node) {
+    node = findFit(size, alignment);
+  }
+  if (node == null_node) {
+    return std::nullopt;
+  }
+  removeFree(node);
+  auto padding = alignUp(_nodes[node].offset, alignment) - _nodes[node].offset;
+  if (padding != 0) {
+    // the front padding becomes a free range, its previous neighbor must not be free since the
+    // neighbors of a free range are always coalesced
+    auto front = node;
+    node = split(front, padding);
+    insertFree(front);
+  }
+  if (_nodes[node].size > size) {
+    insertFree(split(node, size));
+  }
+  _used_size += size;
+  _allocation_count++;
+  return Allocation{ .offset = _nodes[node].offset, .size = size, .node = node };
+}
+
+void TlsfAllocator::free(Allocation allocation) {
+  auto node = allocation.node;
+  toy::throwf(
+    node < _nodes.size() && !_nodes[node].free && _nodes[node].offset == allocation.offset,
+    "free an invalid tlsf allocation"
+  );
+  _used_size -= _nodes[node].size;
+  _allocation_count--;
+  if (auto prev = _nodes[node].prev_phys; prev != null_node && _nodes[prev].free) {
+    removeFree(prev);
+    _nodes[prev].size += _nodes[node].size;
+    _nodes[prev].next_phys = _nodes[node].next_phys;
+    if (_nodes[node].next_phys != null_node) {
+      _nodes[_nodes[node].next_phys].prev_phys = prev;
+    }
+    recycleNode(node);
+    node = prev;
+  }
+  if (auto next = _nodes[node].next_phys; next != null_node && _nodes[next].free) {
+    removeFree(next);
+    _nodes[node].size += _nodes[next].size;
+    _nodes[node].next_phys = _nodes[next].next_phys;
+    if (_nodes[next].next_phys != null_node) {
+      _nodes[_nodes[next].next_phys].prev_phys = node;
+    }
+    recycleNode(next);
+  }
+  insertFree(node);
+}
+
+MemoryAllocator::MemoryAllocator(VkDeviceSize block_size) : _block_size(block_size) {
+  auto& pdevice = Device::getInstance().getPdevice();
+  _granularity = pdevice.getProperties().limits.bufferImageGranularity;
+  auto& memory_properties = pdevice.getMemoryProperties();
+  for (auto memory_type : views::iota(0u, memory_properties.memoryTypeCount)) {
+    auto heap_size =
+      memory_properties.memoryHeaps[memory_properties.memoryTypes[memory_type].heapIndex].size;
+    // do not let one block take too much of a small heap
+    auto pool_block_size = std::min(_block_size, heap_size / 8);
+    for (auto _ : views::iota(0, 2)) {
+      _pools.push_back(Pool{ .memory_type = memory_type, .block_size = pool_block_size });
+    }
+  }
+}
+
+MemoryAllocator::~MemoryAllocator() {
+  auto statistics = getStatistics();
+  if (statistics.allocation_count != 0) {
+    toy::debugf(
+      "error: destroy memory allocator with {} allocations not freed",
+      statistics.allocation_count
+    );
+  }
+}
+
+auto MemoryAllocator::findMemoryType(uint32 type_bits, VkMemoryPropertyFlags property_flags)
+  -> uint32 {
+  auto& memory_properties = Device::getInstance().getPdevice().getMemoryProperties();
+  if (auto optional = toy::findIf(
+        std::span(memory_properties.memoryTypes, memory_properties.memoryTypeCount) |
+          toy::enumerate,
+        [type_bits, property_flags](auto pair) {
+          auto [i, memory_type] = pair;
+          return (type_bits & (1 << i)) &&
+                 (memory_type.propertyFlags & property_flags) == property_flags;
+        }
+      );
+      optional.has_value()) {
+    return optional->first;
+  }
+  toy::throwf("can not find suitable memory type");
+}
+
+auto MemoryAllocator::getPool(uint32 memory_type, ResourceTiling tiling) -> Pool& {
+  // if the granularity is not bigger than any alignment, linear and optimal resources can be
+  // placed side by side
+  if (_granularity <= 1) {
+    tiling = ResourceTiling::LINEAR;
+  }
+  return _pools[memory_type * 2 + static_cast<uint32>(tiling)];
+}
+
+auto MemoryAllocator::createBlock(Pool& pool, VkDeviceSize size, bool dedicated) -> Block& {
+  auto allocate_info = VkMemoryAllocateInfo{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+    .allocationSize = size,
+    .memoryTypeIndex = pool.memory_type,
+  };
+  auto block = std::make_unique<Block>(Block{
+    .memory = rs::Memory{ allocate_info },
+    .allocator = TlsfAllocator{ size },
+    .mapped = nullptr,
+    .pool = &pool,
+    .dedicated = dedicated,
+  });
+  auto& memory_properties = Device::getInstance().getPdevice().getMemoryProperties();
+  if (memory_properties.memoryTypes[pool.memory_type].propertyFlags &
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    // one VkDeviceMemory can only be mapped once at the same time, so map the whole block here and
+    // keep it mapped until the block is freed
+    auto* data = static_cast<void*>(nullptr);
+    checkVkResult(
+      vkMapMemory(Device::getInstance(), block->memory, 0, VK_WHOLE_SIZE, 0, &data), "map memory"
+    );
+    block->mapped = static_cast<std::byte*>(data);
+  }
+  pool.blocks.push_back(std::move(block));
+  return *pool.blocks.back();
+}
+
+auto MemoryAllocator::allocate(
+  VkMemoryRequirements requirements, VkMemoryPropertyFlags property_flags, ResourceTiling tiling
+) -> Allocation {
+  auto& pool = getPool(findMemoryType(requirements.memoryTypeBits, property_flags), tiling);
+  auto  range = std::optional<TlsfAllocator::Allocation>{};
+  auto* block = static_cast<Block*>(nullptr);
+  if (requirements.size > pool.block_size / 2) {
+    // the only range starts at 0 of the memory, which meets any alignment
+    block = &createBlock(pool, requirements.size, true);
+    range = block->allocator.allocate(requirements.size, 1);
+  } else {
+    for (auto& candidate : pool.blocks) {
+      if (candidate->dedicated) {
+        continue;
+      }
+      range = candidate->allocator.allocate(requirements.size, requirements.alignment);
+      if (range.has_value()) {
+        block = candidate.get();
+        break;
+      }
+    }
+    if (!range.has_value()) {
+      block = &createBlock(pool, pool.block_size, false);
+      range = block->allocator.allocate(requirements.size, requirements.alignment);
+    }
+  }
+  if (!range.has_value() && block != nullptr && block->allocator.empty()) {
+    // do not keep the device memory of a block that holds nothing
+    std::erase_if(pool.blocks, [block](auto& b) { return b.get() == block; });
+  }
+  toy::throwf(range.has_value(), "failed to sub-allocate {} bytes memory", requirements.size);
+  return Allocation{
+    .memory = block->memory,
+    .offset = range->offset,
+    .size = range->size,
+    .mapped = block->mapped == nullptr ? nullptr : block->mapped + range->offset,
+    .block = block,
+    .range = *range,
+  };
+}
+
+void MemoryAllocator::free(Allocation const& allocation) {
+  auto* block = allocation.block;
+  block->allocator.free(allocation.range);
+  if (!block->allocator.empty()) {
+    return;
+  }
+  auto& blocks = block->pool->blocks;
+  // keep one empty block for each pool to avoid allocate and free device memory repeatedly
+  auto keep = !block->dedicated && ranges::count_if(blocks, [](auto& b) {
+                                      return !b->dedicated && b->allocator.empty();
+                                    }) == 1;
+  if (!keep) {
+    std::erase_if(blocks, [block](auto& b) { return b.get() == block; });
+  }
+}
+
+auto MemoryAllocator::getStatistics() const -> Statistics {
+  auto statistics = Statistics{};
+  for (auto& pool : _pools) {
+    for (auto& block : pool.blocks) {
+      statistics.block_count++;
+      statistics.allocation_count += block->allocator.getAllocationCount();
+      statistics.reserved_size += block->allocator.getSize();
+      statistics.used_size += block->allocator.getUsedSize();
+    }
+  }
+  return statistics;
+}
+
+} // namespace rd::vk
@@ -0,0 +1,146 @@
+module render.mesh_pool;
+
+import std;
+import toy;
+
+import "vulkan_config.h";
+import render.vk.allocator;
+import render.vk.buffer;
+import render.vk.executor;
+import render.vk.upload;
+import render.vertex;
+
+namespace rd {
+
+MeshPool::MeshPool(
+  VertexInfo     vertex_info,
+  uint32         vertex_capacity,
+  uint32         index_capacity,
+  vk::FamilyType family_type
+)
+  : _executor(&vk::CommandExecutorManager::getInstance()[family_type]),
+    _vertex_stride(vertex_info.binding_descriptions.front().stride),
+    _vertex_buffer(VkDeviceSize{ vertex_capacity } * _vertex_stride, vertex_info),
+    _index_buffer(index_capacity), _vertex_allocator(vertex_capacity),
+    _index_allocator(index_capacity) {}
+
+void MeshPool::free(MeshHandle const& mesh) {
+  _pending_frees.push_back(PendingFree{
+    .vertex_range = mesh.vertex_range,
+    .index_range = mesh.index_range,
+    .retire_value = _executor->getReservedValue(),
+  });
+}
+
+auto MeshPool::getStatistics() const -> Statistics {
+  auto pending_free_count = static_cast<uint32>(_pending_frees.size());
+  return {
+    .mesh_count = _index_allocator.getAllocationCount() - pending_free_count,
+    .used_vertices = _vertex_allocator.getUsedSize(),
+    .used_indices = _index_allocator.getUsedSize(),
+    .pending_free_count = pending_free_count,
+  };
+}
+
+auto MeshPool::allocate(uint32 vertex_count, uint32 index_count, vk::UploadBatch const& batch)
+  -> MeshHandle {
+  toy::throwf(vertex_count > 0 && index_count > 0, "add an empty mesh to the pool");
+  toy::throwf(
+    batch.getDstFamily() == _executor->getFamily(),
+    "the meshes of pool must be uploaded to the family that draws them"
+  );
+  reclaim(false);
+  auto ranges = tryAllocate(vertex_count, index_count);
+  if (!ranges && !_pending_frees.empty()) {
+    reclaim(true);
+    ranges = tryAllocate(vertex_count, index_count);
+  }
+  toy::throwf(
+    ranges.has_value(),
+    "no range for {} vertices and {} indices, {} of {} vertices and {} of {} indices are used",
+    vertex_count,
+    index_count,
+    _vertex_allocator.getUsedSize(),
+    _vertex_allocator.getSize(),
+    _index_allocator.getUsedSize(),
+    _index_allocator.getSize()
+  );
+  auto [vertex_range, index_range] = *ranges;
+  return {
+    .first_index = static_cast<uint32>(index_range.offset),
+    .vertex_offset = static_cast<int32>(vertex_range.offset),
+    .index_count = index_count,
+    .vertex_range = vertex_range,
+    .index_range = index_range,
+  };
+}
+
+auto MeshPool::tryAllocate(uint32 vertex_count, uint32 index_count)
+  -> std::optional<std::pair<vk::TlsfAllocator::Allocation, vk::TlsfAllocator::Allocation>> {
+  auto vertex_range = _vertex_allocator.allocate(vertex_count, 1);
+  if (!vertex_range) {
+    return std::nullopt;
+  }
+  auto index_range = _index_allocator.allocate(index_count, 1);
+  if (!index_range) {
+    _vertex_allocator.free(*vertex_range);
+    return std::nullopt;
+  }
+  return std::pair{ *vertex_range, *index_range };
+}
+
+void MeshPool::reclaim(bool wait) {
+  auto& timeline = _executor->getTimeline();
+  std::erase_if(_pending_frees, [&](PendingFree const& pending) {
+    if (wait) {
+      if (_executor->isPending(pending.retire_value)) {
+        _executor->flush();
+      }
+      timeline.wait(pending.retire_value);
+    } else if (!timeline.isComplete(pending.retire_value)) {
+      return false;
+    }
+    _vertex_allocator.free(pending.vertex_range);
+    _index_allocator.free(pending.index_range);
+    return true;
+  });
+}
+
+MeshDrawList::MeshDrawList(uint32 max_draw_count, vk::FamilyType family_type)
+  : _executor(&vk::CommandExecutorManager::getInstance()[family_type]),
+    _max_draw_count(max_draw_count),
+    _buffer(
+      sizeof(VkDrawIndexedIndirectCommand) * std::max(max_draw_count, 1u),
+      VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT
+    ),
+    _commands(
+      static_cast<VkDrawIndexedIndirectCommand*>(_buffer.memory().data()),
+      std::max(max_draw_count, 1u)
+    ) {}
+
+void MeshDrawList::setMeshes(std::span<const MeshHandle> meshes) {
+  toy::throwf(
+    meshes.size() <= _max_draw_count,
+    "{} meshes exceed the capacity {} of draw list",
+    meshes.size(),
+    _max_draw_count
+  );
+  // the draws of the old list may still be read by the submitted frames, including the pending ones
+  auto value = _executor->getReservedValue();
+  if (_executor->isPending(value)) {
+    _executor->flush();
+  }
+  _executor->getTimeline().wait(value);
+  for (auto [i, mesh] : meshes | toy::enumerate) {
+    _commands[i] = VkDrawIndexedIndirectCommand{
+      .indexCount = mesh.index_count,
+      .instanceCount = 1,
+      .firstIndex = mesh.first_index,
+      .vertexOffset = mesh.vertex_offset,
+      .firstInstance = static_cast<uint32>(i),
+    };
+  }
+  _draw_count = meshes.size();
+}
+
+} // namespace rd
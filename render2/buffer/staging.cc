@@ -0,0 +1,172 @@
+module render.vk.staging;
+
+import std;
+import toy;
+
+import "vulkan_config.h";
+import render.vk.buffer;
+import render.vk.executor;
+
+namespace rd::vk {
+
+StagingRing::StagingRing(VkDeviceSize capacity) : _buffer(capacity), _capacity(capacity) {
+  _statistics.capacity = capacity;
+}
+
+StagingRing::~StagingRing() {
+  // the device may still read the regions
+  while (!_in_flight.empty()) {
+    if (!_in_flight.front().retired()) {
+      toy::debugf("error: destroy staging ring with region {} not retired", _in_flight.front().id);
+      _in_flight.pop_front();
+      continue;
+    }
+    popOldest(true);
+  }
+}
+
+auto StagingRing::popOldest(bool wait) -> bool {
+  auto& oldest = _in_flight.front();
+  toy::throwf(oldest.retired(), "staging region {} is not retired, can not reuse it", oldest.id);
+  if (!oldest.aborted &&
+      !oldest.waitable->wait(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, wait ? ~uint64{ 0 } : 0)) {
+    return false;
+  }
+  _tail = oldest.end;
+  _oversize_bytes -= oldest.oversize_size;
+  _in_flight.pop_front();
+  return true;
+}
+
+void StagingRing::collect() {
+  while (!_in_flight.empty() && _in_flight.front().retired()) {
+    if (!popOldest(false)) {
+      break;
+    }
+  }
+}
+
+auto StagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment) -> StagingRegion {
+  collect();
+  auto id = _next_id++;
+  if (size > _capacity) {
+    auto& region = _in_flight.emplace_back(InFlight{
+      .id = id,
+      .end = _head,
+      .oversize = StagingBuffer{ size },
+      .oversize_size = size,
+    });
+    _oversize_bytes += size;
+    _statistics.oversize_count++;
+    updatePeak();
+    return StagingRegion{
+      .buffer = region.oversize,
+      .offset = 0,
+      .data = { static_cast<std::byte*>(region.oversize->data()), size },
+      .id = id,
+    };
+  }
+
+  auto offset = VkDeviceSize{};
+  auto end = uint64{};
+  auto stall_begin = std::optional<chrono::steady_clock::time_point>{};
+  while (true) {
+    if (_in_flight.empty()) {
+      // all space is free, restart from the beginning of buffer
+      _head = _tail = (_head + _capacity - 1) / _capacity * _capacity;
+    }
+    std::tie(offset, end) = place(size, alignment);
+    if (end - _tail <= _capacity) {
+      break;
+    }
+    if (!stall_begin.has_value()) {
+      stall_begin = chrono::steady_clock::now();
+    }
+    popOldest(true);
+  }
+  if (stall_begin.has_value()) {
+    _statistics.stall_count++;
+    _statistics.stall_time += chrono::steady_clock::now() - *stall_begin;
+  }
+
+  _in_flight.push_back(InFlight{ .id = id, .end = end });
+  _head = end;
+  updatePeak();
+  return StagingRegion{
+    .buffer = _buffer,
+    .offset = offset,
+    .data = { static_cast<std::byte*>(_buffer->data()) + offset, size },
+    .id = id,
+  };
+}
+
+auto StagingRing::place(VkDeviceSize size, VkDeviceSize alignment) const
+  -> std::pair<VkDeviceSize, uint64> {
+  auto head_offset = _head % _capacity;
+  auto offset = (head_offset + alignment - 1) / alignment * alignment;
+  if (offset + size > _capacity) {
+    // not enough space before the end of buffer, skip the rest and start from the beginning
+    offset = _capacity;
+  }
+  return { offset % _capacity, _head + (offset - head_offset) + size };
+}
+
+auto StagingRing::fits(VkDeviceSize size, VkDeviceSize alignment) const -> bool {
+  if (size > _capacity) {
+    // an oversize upload has its own buffer
+    return true;
+  }
+  auto unretired = ranges::find_if(_in_flight, [](auto const& region) {
+    return !region.retired();
+  });
+  if (unretired == _in_flight.end()) {
+    return true;
+  }
+  // waiting reclaims the space up to the oldest region not retired
+  auto tail = unretired == _in_flight.begin() ? _tail : std::prev(unretired)->end;
+  return place(size, alignment).second - tail <= _capacity;
+}
+
+auto StagingRing::upload(std::span<const std::byte> data, VkDeviceSize alignment)
+  -> StagingRegion {
+  auto region = allocate(data.size(), alignment);
+  ranges::copy(data, region.data.begin());
+  return region;
+}
+
+void StagingRing::retire(StagingRegion const& region, Waitable waitable) {
+  retire({ &region, 1 }, std::move(waitable));
+}
+
+void StagingRing::retire(std::span<StagingRegion const> regions, Waitable waitable) {
+  auto shared = std::make_shared<Waitable>(std::move(waitable));
+  for (auto& region : regions) {
+    // usually the regions are the newest ones
+    auto iter = ranges::find(_in_flight | views::reverse, region.id, &InFlight::id);
+    toy::throwf(iter != _in_flight.rend(), "retire unknown staging region {}", region.id);
+    iter->waitable = shared;
+  }
+  collect();
+}
+
+void StagingRing::abort(std::span<StagingRegion const> regions) {
+  for (auto& region : regions) {
+    auto iter = ranges::find(_in_flight | views::reverse, region.id, &InFlight::id);
+    toy::throwf(iter != _in_flight.rend(), "abort unknown staging region {}", region.id);
+    iter->aborted = true;
+  }
+  collect();
+}
+
+void StagingRing::updatePeak() {
+  _statistics.peak_bytes_in_flight =
+    std::max(_statistics.peak_bytes_in_flight, _head - _tail + _oversize_bytes);
+}
+
+auto StagingRing::getStatistics() const -> Statistics {
+  auto statistics = _statistics;
+  statistics.bytes_in_flight = _head - _tail + _oversize_bytes;
+  return statistics;
+}
+
+} // namespace rd::vk
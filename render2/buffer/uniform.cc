@@ -0,0 +1,67 @@
+module render.vk.uniform;
+
+import std;
+import toy;
+
+import "vulkan_config.h";
+import render.vk.device;
+import render.vk.buffer;
+import render.vk.executor;
+
+namespace rd::vk {
+
+UniformRing::UniformRing(VkDeviceSize frame_capacity, uint32 frame_count, FamilyType family_type)
+  : _executor(&CommandExecutorManager::getInstance()[family_type]),
+    _alignment(
+      Device::getInstance().getPdevice().getProperties().limits.minUniformBufferOffsetAlignment
+    ),
+    _frame_capacity((frame_capacity + _alignment - 1) / _alignment * _alignment),
+    _buffer(_frame_capacity * std::max(frame_count, 1u), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) {
+  toy::throwf(frame_count > 0, "uniform ring needs at least one frame");
+  _frames.resize(frame_count);
+  // the first beginFrame() uses the region 0
+  _frame_index = frame_count - 1;
+  _statistics.frame_capacity = _frame_capacity;
+}
+
+UniformRing::~UniformRing() {
+  for (auto& frame : _frames) {
+    _executor->getTimeline().wait(frame.retire_value);
+  }
+}
+
+void UniformRing::beginFrame() {
+  toy::throwf(!_in_frame, "uniform ring begins a frame twice");
+  _frame_index = (_frame_index + 1) % _frames.size();
+  auto& timeline = _executor->getTimeline();
+  if (auto value = _frames[_frame_index].retire_value; !timeline.isComplete(value)) {
+    _statistics.stall_count++;
+    timeline.wait(value);
+  }
+  _frame_used = 0;
+  _in_frame = true;
+}
+
+void UniformRing::endFrame() {
+  toy::throwf(_in_frame, "uniform ring ends a frame that is not begun");
+  // the submissions of the frame are flushed by CommandExecutorManager::endFrame()
+  _frames[_frame_index].retire_value = _executor->getSubmittedValue();
+  _statistics.peak_frame_bytes = std::max(_statistics.peak_frame_bytes, _frame_used);
+  _in_frame = false;
+}
+
+auto UniformRing::allocate(VkDeviceSize size) -> UniformAllocation {
+  toy::throwf(_in_frame, "allocate uniform data out of frame");
+  auto offset = (_frame_used + _alignment - 1) / _alignment * _alignment;
+  toy::throwf(
+    offset + size <= _frame_capacity,
+    "uniform data of a frame exceeds the capacity {}",
+    _frame_capacity
+  );
+  _frame_used = offset + size;
+  auto buffer_offset = _frame_index * _frame_capacity + offset;
+  auto data = static_cast<std::byte*>(_buffer.memory().data()) + buffer_offset;
+  return { { data, size }, static_cast<uint32>(buffer_offset) };
+}
+
+} // namespace rd::vk
@@ -0,0 +1,204 @@
+module render.vk.upload;
+
+import std;
+import toy;
+
+import "vulkan_config.h";
+import render.vk.sync;
+import render.vk.executor;
+import render.vk.staging;
+import render.vk.buffer;
+import render.vk.image;
+
+namespace rd::vk {
+
+constexpr auto copy_scope = Scope{
+  .stage_mask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+  .access_mask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+};
+
+UploadBatch::UploadBatch(FamilyType dst_family_type)
+  : _src_executor(&CommandExecutorManager::getInstance()[FamilyType::TRANSFER]),
+    _dst_executor(&CommandExecutorManager::getInstance()[dst_family_type]) {}
+
+UploadBatch::~UploadBatch() {
+  if (!empty()) {
+    toy::debugf("drop an upload batch of {} uploads not submitted", _staging_regions.size());
+    StagingRing::getInstance().abort(_staging_regions);
+  }
+}
+
+auto UploadBatch::stage(VkDeviceSize size) -> StagingRegion {
+  auto& ring = StagingRing::getInstance();
+  if (!empty() && !ring.fits(size)) {
+    // the waitable is not needed, the later submissions on dst family come after this one
+    submit();
+  }
+  auto staging = ring.allocate(size);
+  _staging_regions.push_back(staging);
+  return staging;
+}
+
+void UploadBatch::uploadBuffer(
+  VkBuffer buffer, std::span<const std::byte> data, Scope dst_scope, VkDeviceSize offset
+) {
+  ranges::copy(data, stageBuffer(buffer, data.size(), dst_scope, offset).begin());
+}
+
+auto UploadBatch::stageBuffer(
+  VkBuffer buffer, VkDeviceSize size, Scope dst_scope, VkDeviceSize offset
+) -> std::span<std::byte> {
+  auto staging = stage(size);
+  _buffer_copies.push_back(
+    BufferCopy{ .dst_buffer = buffer, .dst_offset = offset, .staging = staging }
+  );
+
+  auto barrier = VkBufferMemoryBarrier2{
+    .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+    .srcStageMask = copy_scope.stage_mask,
+    .srcAccessMask = copy_scope.access_mask,
+    .dstStageMask = dst_scope.stage_mask,
+    .dstAccessMask = dst_scope.access_mask,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .buffer = buffer,
+    .offset = offset,
+    .size = size,
+  };
+  if (!needFamilyTransfer()) {
+    _release_buffer_barriers.push_back(barrier);
+    return staging.data;
+  }
+  // see BarrierScope for the scopes of ownership transfer
+  barrier.srcQueueFamilyIndex = _src_executor->getFamily();
+  barrier.dstQueueFamilyIndex = _dst_executor->getFamily();
+  auto release = barrier;
+  release.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+  release.dstAccessMask = VK_ACCESS_2_NONE;
+  _release_buffer_barriers.push_back(release);
+  auto acquire = barrier;
+  acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+  acquire.srcAccessMask = VK_ACCESS_2_NONE;
+  _acquire_buffer_barriers.push_back(acquire);
+  return staging.data;
+}
+
+void UploadBatch::uploadImage(ImageUpload const& upload) {
+  auto staging = stage(upload.data.size());
+  ranges::copy(upload.data, staging.data.begin());
+  _image_copies.push_back(ImageCopy{
+    .dst_image = upload.image,
+    .subresource_range = upload.subresource_range,
+    .extent = upload.extent,
+    .staging = staging,
+  });
+
+  _copy_image_barriers.push_back(VkImageMemoryBarrier2{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+    .srcStageMask = VK_PIPELINE_STAGE_2_NONE,
+    .srcAccessMask = VK_ACCESS_2_NONE,
+    .dstStageMask = copy_scope.stage_mask,
+    .dstAccessMask = copy_scope.access_mask,
+    .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image = upload.image,
+    .subresourceRange = upload.subresource_range,
+  });
+  auto barrier = VkImageMemoryBarrier2{
+    .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+    .srcStageMask = copy_scope.stage_mask,
+    .srcAccessMask = copy_scope.access_mask,
+    .dstStageMask = upload.dst_scope.stage_mask,
+    .dstAccessMask = upload.dst_scope.access_mask,
+    .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+    .newLayout = upload.dst_layout,
+    .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+    .image = upload.image,
+    .subresourceRange = upload.subresource_range,
+  };
+  if (!needFamilyTransfer()) {
+    _release_image_barriers.push_back(barrier);
+    return;
+  }
+  // the layout transition is done once, between the release and the acquire
+  barrier.srcQueueFamilyIndex = _src_executor->getFamily();
+  barrier.dstQueueFamilyIndex = _dst_executor->getFamily();
+  auto release = barrier;
+  release.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+  release.dstAccessMask = VK_ACCESS_2_NONE;
+  _release_image_barriers.push_back(release);
+  auto acquire = barrier;
+  acquire.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+  acquire.srcAccessMask = VK_ACCESS_2_NONE;
+  _acquire_image_barriers.push_back(acquire);
+}
+
+void UploadBatch::addAcquireRecorder(std::function<void(VkCommandBuffer)> recorder) {
+  _acquire_recorders.push_back(std::move(recorder));
+}
+
+auto UploadBatch::submit() -> Waitable {
+  toy::throwf(!empty(), "submit an empty upload batch");
+  auto copy_recorder = [this](VkCommandBuffer cmdbuf) {
+    if (!_copy_image_barriers.empty()) {
+      recordPipelineBarrier(cmdbuf, {}, {}, _copy_image_barriers);
+    }
+    for (auto& copy : _buffer_copies) {
+      recordCopyBuffer(
+        cmdbuf,
+        copy.staging.buffer,
+        copy.dst_buffer,
+        copy.staging.data.size(),
+        copy.staging.offset,
+        copy.dst_offset
+      );
+    }
+    for (auto& copy : _image_copies) {
+      copyBufferToImage(
+        cmdbuf,
+        copy.staging.buffer,
+        copy.dst_image,
+        static_cast<VkImageAspectFlagBits>(copy.subresource_range.aspectMask),
+        copy.extent.width,
+        copy.extent.height,
+        copy.subresource_range.baseMipLevel,
+        copy.staging.offset
+      );
+    }
+    recordPipelineBarrier(cmdbuf, {}, _release_buffer_barriers, _release_image_barriers);
+  };
+  auto acquire_recorder = [this](VkCommandBuffer cmdbuf) {
+    if (!_acquire_buffer_barriers.empty() || !_acquire_image_barriers.empty()) {
+      recordPipelineBarrier(cmdbuf, {}, _acquire_buffer_barriers, _acquire_image_barriers);
+    }
+    for (auto& recorder : _acquire_recorders) {
+      recorder(cmdbuf);
+    }
+  };
+
+  auto copy_waitable = _src_executor->submit(copy_recorder);
+  auto waitable = _dst_executor->submit(CommandBatch{
+    .recorder = acquire_recorder,
+    .waits = { { &copy_waitable, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT } },
+  });
+  StagingRing::getInstance().retire(_staging_regions, std::move(copy_waitable));
+  clear();
+  return waitable;
+}
+
+void UploadBatch::clear() {
+  _staging_regions.clear();
+  _buffer_copies.clear();
+  _image_copies.clear();
+  _copy_image_barriers.clear();
+  _release_buffer_barriers.clear();
+  _release_image_barriers.clear();
+  _acquire_buffer_barriers.clear();
+  _acquire_image_barriers.clear();
+  _acquire_recorders.clear();
+}
+
+} // namespace rd::vk
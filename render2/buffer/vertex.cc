@@ -1,11 +1,13 @@
 module render.vertex;
 
 import render.vk.executor;
+import render.vk.upload;
 
 namespace rd {
 
 auto operator==(const VertexInfo& a, const VertexInfo& b) -> bool {
-  return a.binding_description == b.binding_description &&
+  return a.binding_descriptions.begin() == b.binding_descriptions.begin() &&
+         a.binding_descriptions.end() == b.binding_descriptions.end() &&
          a.attribute_descriptions.begin() == b.attribute_descriptions.begin() &&
          a.attribute_descriptions.end() == b.attribute_descriptions.end();
 }
@@ -16,73 +18,232 @@ auto vk::device_checkers::vertex(vk::DeviceCapabilityBuilder& builder) -> bool {
   toy::debugf("the vertex formats: {::}", formats | views::transform([](auto a) {
                                             return static_cast<uint32>(a);
                                           }));
-  if (!builder.enableFeature(&VkPhysicalDeviceFeatures::shaderFloat64)) {
-    return false;
+  // 64-bit attributes are optional, so the device is not rejected for lack of them
+  auto float64 = builder.enableFeature(&VkPhysicalDeviceFeatures::shaderFloat64);
+  if (!float64) {
+    toy::debugf("shaderFloat64 is not supported, 64-bit vertex formats are unavailable");
   }
+  auto required_formats =
+    formats | views::filter([&](VkFormat format) { return float64 || !is64BitFormat(format); }) |
+    ranges::to<std::vector>();
   return builder.getPdevice().checkFormatSupport(
-    vk::FormatTarget::BUFFER, VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT, formats
+    vk::FormatTarget::BUFFER, VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT, required_formats
   );
 }
 
 DeviceLocalBuffer::DeviceLocalBuffer(
   VkBufferUsageFlags usage, vk::Scope dst_scope, std::span<const std::byte> buffer_data
 ) {
-  auto& ctx = vk::Device::getInstance();
+  auto batch = vk::UploadBatch{};
+  *this = DeviceLocalBuffer{ usage, dst_scope, buffer_data, batch };
+  batch.submit();
+}
 
-  auto buffer_size = (uint32)buffer_data.size();
-  _staging_buffer = { buffer_data };
+DeviceLocalBuffer::DeviceLocalBuffer(
+  VkBufferUsageFlags         usage,
+  vk::Scope                  dst_scope,
+  std::span<const std::byte> buffer_data,
+  vk::UploadBatch&           batch
+)
+  : vk::Buffer(
+      buffer_data.size(),
+      usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+    ),
+    _tracker(get()), _size(buffer_data.size()) {
+  upload(0, buffer_data, dst_scope, batch);
+}
 
-  vk::Buffer::operator=({
-    buffer_size,
-    usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-    VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-  });
-  _tracker = { get() };
+DeviceLocalBuffer::DeviceLocalBuffer(VkBufferUsageFlags usage, VkDeviceSize size)
+  : vk::Buffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+    _tracker(get()), _size(size) {}
 
-  auto& copy_executor = vk::CommandExecutorManager::getInstance()[vk::FamilyType::TRANSFER];
-  auto& graphcis_executor = vk::CommandExecutorManager::getInstance()[vk::FamilyType::GRAPHICS];
+void DeviceLocalBuffer::upload(
+  VkDeviceSize               offset,
+  std::span<const std::byte> data,
+  vk::Scope                  dst_scope,
+  vk::UploadBatch&           batch
+) {
+  ranges::copy(data, stage(offset, data.size(), dst_scope, batch).begin());
+}
 
-  _tracker.setNewScope(
-    vk::Scope{
-      .stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT,
-      .access_mask = VK_ACCESS_TRANSFER_WRITE_BIT,
-    },
-    copy_executor.getFamily()
+auto DeviceLocalBuffer::stage(
+  VkDeviceSize offset, VkDeviceSize size, vk::Scope dst_scope, vk::UploadBatch& batch
+) -> std::span<std::byte> {
+  toy::throwf(
+    offset + size <= this->size(),
+    "upload [{}, {}) out of the buffer of {} bytes",
+    offset,
+    offset + size,
+    this->size()
+  );
+  auto staging = batch.stageBuffer(*this, size, dst_scope, offset);
+  // the ownership has been transferred to dst family once the batch is complete
+  _tracker.setNewScope(dst_scope, batch.getDstFamily());
+  return staging;
+}
+
+constexpr auto vertex_scope = vk::Scope{
+  .stage_mask = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+  .access_mask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+};
+constexpr auto index_scope = vk::Scope{
+  .stage_mask = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+  .access_mask = VK_ACCESS_INDEX_READ_BIT,
+};
+
+// a position stream read by a depth-only pass and a stream of the other attributes
+using SplitLayout = VertexStreams<Vertex<glm::vec3>, Vertex<glm::vec2, glm::vec3>>;
+static_assert(
+  SplitLayout::binding_descriptions[1].binding == 1 &&
+  SplitLayout::binding_descriptions[1].stride == sizeof(Vertex<glm::vec2, glm::vec3>) &&
+  SplitLayout::binding_descriptions[1].inputRate == VK_VERTEX_INPUT_RATE_VERTEX
+);
+static_assert(
+  SplitLayout::attribute_descriptions[0].binding == 0 &&
+  SplitLayout::attribute_descriptions[1].location == 1 &&
+  SplitLayout::attribute_descriptions[1].binding == 1 &&
+  SplitLayout::attribute_descriptions[2].location == 2 &&
+  SplitLayout::attribute_descriptions[2].binding == 1 &&
+  SplitLayout::attribute_descriptions[2].offset == sizeof(glm::vec2)
+);
+
+// a mesh stream and a per-instance transform, which spans four locations
+using InstancedLayout = VertexStreams<
+  Vertex<glm::vec3, glm::vec2>,
+  PerInstance<Vertex<glm::vec4, glm::vec4, glm::vec4, glm::vec4>>>;
+static_assert(
+  InstancedLayout::binding_descriptions[0].inputRate == VK_VERTEX_INPUT_RATE_VERTEX &&
+  InstancedLayout::binding_descriptions[1].binding == 1 &&
+  InstancedLayout::binding_descriptions[1].stride == sizeof(glm::mat4) &&
+  InstancedLayout::binding_descriptions[1].inputRate == VK_VERTEX_INPUT_RATE_INSTANCE
+);
+static_assert(ranges::all_of(views::iota(2u, 6u), [](uint32 location) {
+  auto const& attribute = InstancedLayout::attribute_descriptions[location];
+  return attribute.location == location && attribute.binding == 1 &&
+         attribute.format == VK_FORMAT_R32G32B32A32_SFLOAT &&
+         attribute.offset == (location - 2) * sizeof(glm::vec4);
+}));
+
+VertexBuffer::VertexBuffer(
+  std::span<const std::span<const std::byte>> streams, VertexInfo vertex_info
+) {
+  auto batch = vk::UploadBatch{};
+  *this = VertexBuffer{ streams, vertex_info, batch };
+  batch.submit();
+}
+
+VertexBuffer::VertexBuffer(
+  std::span<const std::span<const std::byte>> streams,
+  VertexInfo                                   vertex_info,
+  vk::UploadBatch&                             batch
+)
+  : _vertex_info(vertex_info) {
+  toy::throwf(
+    vertex_info.binding_descriptions.empty() ||
+      streams.size() == vertex_info.binding_descriptions.size(),
+    "{} vertex streams for {} bindings",
+    streams.size(),
+    vertex_info.binding_descriptions.size()
+  );
+  if (streams.size() == 1) {
+    DeviceLocalBuffer::operator=(
+      DeviceLocalBuffer{ VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertex_scope, streams[0], batch }
+    );
+    _stream_offsets = { 0 };
+    return;
+  }
+  // every stream starts at an offset aligned for any attribute format
+  constexpr auto stream_alignment = VkDeviceSize{ 16 };
+  auto           size = VkDeviceSize{ 0 };
+  for (auto stream : streams) {
+    _stream_offsets.push_back(size);
+    size = (size + stream.size() + stream_alignment - 1) / stream_alignment * stream_alignment;
+  }
+  auto data = std::vector<std::byte>(size);
+  for (auto [stream, offset] : views::zip(streams, _stream_offsets)) {
+    ranges::copy(stream, data.begin() + offset);
+  }
+  DeviceLocalBuffer::operator=(
+    DeviceLocalBuffer{ VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertex_scope, data, batch }
   );
-  auto barrier = _tracker.syncScope(dst_scope, graphcis_executor.getFamily());
-  auto& [release, acquire, _] = std::get<vk::FamilyTransferRecorder>(barrier);
-
-  auto copy_recorder = [&](VkCommandBuffer cmdbuf) {
-    vk::recordCopyBuffer(cmdbuf, _staging_buffer, *this, buffer_size);
-    release(cmdbuf);
-  };
-  auto waitable = copy_executor.submit(copy_recorder);
-  graphcis_executor.submit(vk::CommandBatch{
-    .recorder = std::move(acquire),
-    .waits = { { &waitable, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT } },
-  });
 }
 
-VertexBuffer::VertexBuffer(std::span<const std::byte> vertex_data, VertexInfo vertex_info)
+VertexBuffer::VertexBuffer(VkDeviceSize size, VertexInfo vertex_info)
+  : DeviceLocalBuffer(VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, size), _vertex_info(vertex_info),
+    _stream_offsets{ 0 } {
+  toy::throwf(
+    vertex_info.binding_descriptions.size() == 1,
+    "a shared vertex buffer holds one stream, not {}",
+    vertex_info.binding_descriptions.size()
+  );
+}
+
+void VertexBuffer::write(
+  VkDeviceSize offset, std::span<const std::byte> data, vk::UploadBatch& batch
+) {
+  upload(offset, data, vertex_scope, batch);
+}
+
+IndexBuffer::IndexBuffer(std::span<const uint16> indices)
+  : DeviceLocalBuffer(VK_BUFFER_USAGE_INDEX_BUFFER_BIT, index_scope, std::as_bytes(indices)),
+    _index_number(indices.size()), _index_type(VK_INDEX_TYPE_UINT16) {}
+
+IndexBuffer::IndexBuffer(std::span<const uint16> indices, vk::UploadBatch& batch)
   : DeviceLocalBuffer(
-      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-      vk::Scope{
-        .stage_mask = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
-        .access_mask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
-      },
-      vertex_data
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT, index_scope, std::as_bytes(indices), batch
     ),
-    _vertex_info(vertex_info) {}
+    _index_number(indices.size()), _index_type(VK_INDEX_TYPE_UINT16) {}
+
+IndexBuffer::IndexBuffer(std::span<const uint32> indices) {
+  auto batch = vk::UploadBatch{};
+  *this = IndexBuffer{ indices, batch };
+  batch.submit();
+}
 
-IndexBuffer::IndexBuffer(std::span<const uint16_t> indices)
+IndexBuffer::IndexBuffer(std::span<const uint32> indices, vk::UploadBatch& batch) {
+  if (chooseIndexType(indices) == VK_INDEX_TYPE_UINT16) {
+    auto narrow_indices = indices | views::transform([](uint32 index) {
+                            return static_cast<uint16>(index);
+                          }) |
+                          ranges::to<std::vector>();
+    *this = IndexBuffer{ std::span<const uint16>{ narrow_indices }, batch };
+    return;
+  }
+  DeviceLocalBuffer::operator=(DeviceLocalBuffer{
+    VK_BUFFER_USAGE_INDEX_BUFFER_BIT, index_scope, std::as_bytes(indices), batch
+  });
+  _index_number = indices.size();
+  _index_type = VK_INDEX_TYPE_UINT32;
+}
+
+IndexBuffer::IndexBuffer(uint32 index_capacity)
   : DeviceLocalBuffer(
-      VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
-      vk::Scope{
-        .stage_mask = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
-        .access_mask = VK_ACCESS_INDEX_READ_BIT,
-      },
-      std::as_bytes(indices)
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VkDeviceSize{ index_capacity } * sizeof(uint32)
     ),
-    _index_number(indices.size()) {}
+    _index_number(0), _index_type(VK_INDEX_TYPE_UINT32) {}
+
+void IndexBuffer::write(
+  uint32 first_index, std::span<const uint32> indices, vk::UploadBatch& batch
+) {
+  toy::throwf(_index_type == VK_INDEX_TYPE_UINT32, "write uint32 indices to a uint16 buffer");
+  upload(VkDeviceSize{ first_index } * sizeof(uint32), std::as_bytes(indices), index_scope, batch);
+}
+
+void IndexBuffer::write(
+  uint32 first_index, std::span<const uint16> indices, vk::UploadBatch& batch
+) {
+  toy::throwf(_index_type == VK_INDEX_TYPE_UINT32, "write uint32 indices to a uint16 buffer");
+  auto offset = VkDeviceSize{ first_index } * sizeof(uint32);
+  auto staging = stage(offset, indices.size() * sizeof(uint32), index_scope, batch);
+  // the staging regions are aligned to StagingRing::default_alignment, which holds uint32
+  ranges::copy(indices, reinterpret_cast<uint32*>(staging.data()));
+}
+
+auto IndexBuffer::chooseIndexType(std::span<const uint32> indices) -> VkIndexType {
+  auto max_index = indices.empty() ? uint32{ 0 } : ranges::max(indices);
+  return max_index < std::numeric_limits<uint16>::max() ? VK_INDEX_TYPE_UINT16
+                                                        : VK_INDEX_TYPE_UINT32;
+}
 
 } // namespace rd
@@ -6,6 +6,7 @@ import render.sampler;
 import render.vertex;
 import render.vk.presentation;
 import render.vk.swapchain;
+import render.vk.culling;
 
 import "vulkan_config.h";
 
@@ -49,15 +50,25 @@ Context::Context(const std::string& app_name, uint32 width, uint32 height) {
     DeviceCapabilityChecker{ SampledTexture::checkPdevice },
     DeviceCapabilityChecker{ device_checkers::vertex },
     DeviceCapabilityChecker{ device_checkers::sync },
+    DeviceCapabilityChecker{ device_checkers::indirect },
   };
   _device.reset(new Device{ device_checkers });
+  _pipeline_cache.reset(new PipelineCache{});
+  _layout_cache.reset(new LayoutCache{});
+  _thread_pool.reset(new toy::ThreadPool{});
+  _memory_allocator.reset(new MemoryAllocator{});
   auto family_counts = queue_requestor.getFamilyQueueCounts(*_device);
-  auto family_info = std::vector<std::pair<FamilyType, FamilyQueueCount>>(3);
+  auto family_info = std::vector<std::pair<FamilyType, FamilyQueueCount>>(4);
   using enum FamilyType;
   family_info[0] = { GRAPHICS, family_counts[0] };
   family_info[1] = { PRESENT, family_counts[1] };
   family_info[2] = { TRANSFER, family_counts[2] };
+  // the graphics family always supports compute, recording the compute work in the command buffer
+  // of draws needs no semaphore and ownership transfer between them
+  family_info[3] = { COMPUTE, family_counts[0] };
   _command_executor_manager.reset(new CommandExecutorManager{ family_info });
+  _staging_ring.reset(new StagingRing{});
+  _uniform_ring.reset(new UniformRing{});
 }
 
 } // namespace rd
@@ -144,10 +144,11 @@ void copyBufferToImage(
   VkImageAspectFlagBits aspect,
   uint32              width,
   uint32              height,
-  uint32              mip_level
+  uint32              mip_level,
+  VkDeviceSize          buffer_offset
 ) {
   auto image_copy = VkBufferImageCopy{
-    .bufferOffset = 0,
+    .bufferOffset = buffer_offset,
     // bufferRowLength and bufferImageHeight
     // 用于更详细的定义buffer的内存如何映射到image
     .bufferRowLength = 0,
@@ -3,6 +3,7 @@ module render.sampler;
 import "vulkan_config.h";
 import render.vk.sync;
 import render.vk.executor;
+import render.vk.upload;
 
 import "stb_image.h";
 
@@ -53,6 +54,18 @@ decltype(SampledTexture::_formats) SampledTexture::_formats = { VK_FORMAT_R8G8B8
 
 SampledTexture::SampledTexture(
   const std::string& path, bool mipmap, VkPipelineStageFlagBits use_stage
+) {
+  auto batch = vk::UploadBatch{};
+  *this = SampledTexture{ path, mipmap, use_stage, batch };
+  // todo: no need to wait, sync with sema
+  batch.submit().wait(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+}
+
+SampledTexture::SampledTexture(
+  const std::string&      path,
+  bool                    mipmap,
+  VkPipelineStageFlagBits use_stage,
+  vk::UploadBatch&        batch
 ) {
   auto& ctx = vk::Device::getInstance();
 
@@ -70,10 +83,6 @@ SampledTexture::SampledTexture(
   auto image_data = std::as_bytes(std::span{ pixels, image_size });
   toy::debugf("image {} info: width {}, height {}", path.data(), width, height);
 
-  _staging_buffer = { image_data };
-
-  stbi_image_free(pixels);
-
   auto mip_extents = std::vector<VkExtent2D>{};
   auto mip_range = vk::MipRange{
     .base_level = 0,
@@ -91,143 +100,103 @@ SampledTexture::SampledTexture(
   };
 
   _sampler = createSampler(_max_anisotropy);
-  auto& copy_executor = vk::CommandExecutorManager::getInstance()[vk::FamilyType::TRANSFER];
-  auto& graphics_executor = vk::CommandExecutorManager::getInstance()[vk::FamilyType::GRAPHICS];
-  auto  family_transfer =
-    vk::FamilyTransferInfo{ copy_executor.getFamily(), graphics_executor.getFamily() };
 
-  auto recorder_copy = [&](VkCommandBuffer cmdbuf) {
-    vk::recordImageBarrier(
-      cmdbuf,
-      _image,
-      vk::getSubresourceRange(_aspect, mip_range),
-      { VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL },
-      {
-        vk::Scope{
-          .stage_mask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
-        },
-        vk::Scope{
-          .stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT,
-          .access_mask = VK_ACCESS_TRANSFER_WRITE_BIT,
-        },
-      },
-      {}
-    );
-
-    vk::copyBufferToImage(cmdbuf, _staging_buffer, _image, _aspect, width, height, 0);
-
-    vk::recordImageBarrier(
-      cmdbuf,
-      _image,
-      vk::getSubresourceRange(_aspect, mip_range),
-      {
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        mipmap ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-      },
-      vk::BarrierScope::release(vk::Scope{
-        .stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT,
-        .access_mask = VK_ACCESS_TRANSFER_WRITE_BIT,
-      }),
-      family_transfer
-    );
-  };
-
-  auto recorder_blit = [&](VkCommandBuffer cmdbuf) {
-    vk::recordImageBarrier(
-        cmdbuf,
-        _image,
-        vk::getSubresourceRange(_aspect, mip_range),
-        {
-          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-          mipmap ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        },
-        vk::BarrierScope::acquire(mipmap ? vk::Scope{
-          .stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT,
-          .access_mask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT,
-        }: vk::Scope{
-          .stage_mask = use_stage,
-          .access_mask = VK_ACCESS_SHADER_READ_BIT,
-        }),
-        family_transfer
-      );
+  auto& graphics_executor = vk::CommandExecutorManager::getInstance()[vk::FamilyType::GRAPHICS];
+  toy::throwf(
+    batch.getDstFamily() == graphics_executor.getFamily(),
+    "mipmaps of sampled texture must be generated on graphics family"
+  );
+  batch.uploadImage(vk::ImageUpload{
+    .image = _image,
+    .subresource_range = vk::getSubresourceRange(_aspect, mip_range),
+    .extent = { width, height },
+    .data = image_data,
+    .dst_layout =
+      mipmap ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    .dst_scope = mipmap ? vk::Scope{
+      .stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+      .access_mask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+    }: vk::Scope{
+      .stage_mask = use_stage,
+      .access_mask = VK_ACCESS_SHADER_READ_BIT,
+    },
+  });
+  // the data has been copied to staging memory
+  stbi_image_free(pixels);
 
-    if (mipmap) {
-      for (auto dst_mip_level : views::iota(1u, mip_extents.size())) {
-        vk::recordImageBarrier(
-          cmdbuf,
-          _image,
-          vk::getSubresourceRange(
-            _aspect, vk::MipRange{ .base_level = dst_mip_level - 1, .count = 1 }
-          ),
-          { VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL },
-          { vk::Scope{
-              .stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT,
-              .access_mask = VK_ACCESS_TRANSFER_WRITE_BIT,
-            },
-            vk::Scope{
-              .stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT,
-              .access_mask = VK_ACCESS_TRANSFER_READ_BIT,
-            } },
-          {}
-        );
-        vk::blitImage(
-          cmdbuf,
-          vk::ImageBlit{
-            .image = _image,
-            .aspect = _aspect,
-            .layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-            .mip_level = dst_mip_level - 1,
-            .extent = mip_extents[dst_mip_level - 1],
-          },
-          vk::ImageBlit{
-            .image = _image,
-            .aspect = _aspect,
-            .layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-            .mip_level = dst_mip_level,
-            .extent = mip_extents[dst_mip_level],
-          }
-        );
-      }
+  if (!mipmap) {
+    return;
+  }
+  auto image = _image.get();
+  auto recorder_blit = [image, mip_extents, mip_levels, use_stage](VkCommandBuffer cmdbuf) {
+    for (auto dst_mip_level : views::iota(1u, mip_extents.size())) {
       vk::recordImageBarrier(
         cmdbuf,
-        _image,
-        vk::getSubresourceRange(_aspect, { .base_level = mip_levels - 1, .count = 1 }),
-        { VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+        image,
+        vk::getSubresourceRange(
+          _aspect, vk::MipRange{ .base_level = dst_mip_level - 1, .count = 1 }
+        ),
+        { VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL },
         { vk::Scope{
             .stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT,
             .access_mask = VK_ACCESS_TRANSFER_WRITE_BIT,
           },
           vk::Scope{
-            .stage_mask = use_stage,
-            .access_mask = VK_ACCESS_SHADER_READ_BIT,
+            .stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+            .access_mask = VK_ACCESS_TRANSFER_READ_BIT,
           } },
         {}
       );
-      vk::recordImageBarrier(
+      vk::blitImage(
         cmdbuf,
-        _image,
-        vk::getSubresourceRange(_aspect, { .base_level = 0, .count = mip_levels - 1 }),
-        { VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
-        { vk::Scope{
-            .stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT,
-            .access_mask = 0,
-          },
-          vk::Scope{
-            .stage_mask = use_stage,
-            .access_mask = VK_ACCESS_SHADER_READ_BIT,
-          } },
-        {}
+        vk::ImageBlit{
+          .image = image,
+          .aspect = _aspect,
+          .layout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+          .mip_level = dst_mip_level - 1,
+          .extent = mip_extents[dst_mip_level - 1],
+        },
+        vk::ImageBlit{
+          .image = image,
+          .aspect = _aspect,
+          .layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          .mip_level = dst_mip_level,
+          .extent = mip_extents[dst_mip_level],
+        }
       );
     }
+    vk::recordImageBarrier(
+      cmdbuf,
+      image,
+      vk::getSubresourceRange(_aspect, { .base_level = mip_levels - 1, .count = 1 }),
+      { VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+      { vk::Scope{
+          .stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+          .access_mask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        },
+        vk::Scope{
+          .stage_mask = use_stage,
+          .access_mask = VK_ACCESS_SHADER_READ_BIT,
+        } },
+      {}
+    );
+    vk::recordImageBarrier(
+      cmdbuf,
+      image,
+      vk::getSubresourceRange(_aspect, { .base_level = 0, .count = mip_levels - 1 }),
+      { VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL },
+      { vk::Scope{
+          .stage_mask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+          .access_mask = 0,
+        },
+        vk::Scope{
+          .stage_mask = use_stage,
+          .access_mask = VK_ACCESS_SHADER_READ_BIT,
+        } },
+      {}
+    );
   };
-
-  auto waitable = copy_executor.submit(recorder_copy);
-  auto fence = graphics_executor.submit(vk::CommandBatch{
-    .recorder = recorder_blit,
-    .waits = { { &waitable, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT } },
-  });
-  // todo: no need to wait, sync with sema
-  fence.wait(VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+  batch.addAcquireRecorder(recorder_blit);
 }
 
-}; // namespace rd
\ No newline at end of file
+}; // namespace rd
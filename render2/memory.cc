@@ -7,6 +7,7 @@ import "vulkan_config.h";
 import render.vk.tool;
 import render.vk.resource;
 import render.vk.device;
+import render.vk.allocator;
 
 namespace rd::vk {
 
@@ -23,9 +24,12 @@ Memory::Memory(VkBuffer buffer, VkMemoryPropertyFlags property_flags)
         vkGetBufferMemoryRequirements(Device::getInstance(), buffer, &memory_requirements);
         return memory_requirements;
       }(),
-      property_flags
+      property_flags,
+      ResourceTiling::LINEAR
     ) {
-  vkBindBufferMemory(Device::getInstance(), buffer, get(), 0);
+  checkVkResult(
+    vkBindBufferMemory(Device::getInstance(), buffer, get(), offset()), "bind buffer memory"
+  );
 }
 Memory::Memory(VkImage image, VkMemoryPropertyFlags property_flags)
   : Memory(
@@ -34,68 +38,31 @@ Memory::Memory(VkImage image, VkMemoryPropertyFlags property_flags)
         vkGetImageMemoryRequirements(Device::getInstance(), image, &memory_requirements);
         return memory_requirements;
       }(),
-      property_flags
+      property_flags,
+      // createImage() always use VK_IMAGE_TILING_OPTIMAL
+      ResourceTiling::OPTIMAL
     ) {
-  vkBindImageMemory(Device::getInstance(), image, get(), 0);
+  checkVkResult(
+    vkBindImageMemory(Device::getInstance(), image, get(), offset()), "bind image memory"
+  );
 }
-Memory::Memory(VkMemoryRequirements requirements, VkMemoryPropertyFlags property_flags) {
-  auto& device = Device::getInstance();
+Memory::Memory(
+  VkMemoryRequirements requirements, VkMemoryPropertyFlags property_flags, ResourceTiling tiling
+)
+  : _allocation(MemoryAllocator::getInstance().allocate(requirements, property_flags, tiling)) {}
 
-  auto     memory_properties = device.getPdevice().getMemoryProperties();
-  uint32 memory_type_index;
-  if (auto optional = toy::findIf(
-        std::span(memory_properties.memoryTypes, memory_properties.memoryTypeCount) |
-          toy::enumerate,
-        [requirements, property_flags](auto pair) {
-          auto [i, memory_type] = pair;
-          return (requirements.memoryTypeBits & (1 << i)) &&
-                 (memory_type.propertyFlags & property_flags) == property_flags;
-        }
-      );
-      optional.has_value()) {
-    memory_type_index = optional->first;
-  } else {
-    toy::throwf("can not find suitable memory type");
+void Memory::free() {
+  if (_allocation.block != nullptr) {
+    MemoryAllocator::getInstance().free(_allocation);
+    _allocation = {};
   }
-  auto allocate_info = VkMemoryAllocateInfo{
-    .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-    .allocationSize = requirements.size,
-    .memoryTypeIndex = memory_type_index,
-  };
-  rs::Memory::operator=(allocate_info);
 }
 
-HostVisibleMemory::HostVisibleMemory(HostVisibleMemory&& e) noexcept {
-  _data = e._data;
-  _memory = e._memory;
-  e._data = nullptr;
-}
-
-auto HostVisibleMemory::operator=(HostVisibleMemory&& e) noexcept -> HostVisibleMemory& {
-  unmap();
-  _data = e._data;
-  _memory = e._memory;
-  e._data = nullptr;
-  return *this;
-}
-
-auto HostVisibleMemory::data() -> void* {
-  if (_data == nullptr) {
-    checkVkResult(
-      vkMapMemory(Device::getInstance(), _memory, 0, VK_WHOLE_SIZE, 0, &_data), "map memory"
-    );
-  }
-  return _data;
-}
 void HostVisibleMemory::fill(std::span<const std::byte> buffer_data) {
-  auto buffer_size = buffer_data.size();
-  std::copy(buffer_data.begin(), buffer_data.end(), reinterpret_cast<std::byte*>(data()));
-}
-
-void HostVisibleMemory::unmap() {
-  if (_data != nullptr) {
-    vkUnmapMemory(Device::getInstance(), _memory);
-  }
+  toy::throwf(
+    buffer_data.size() <= _size, "fill {} bytes to {} bytes memory", buffer_data.size(), _size
+  );
+  std::copy(buffer_data.begin(), buffer_data.end(), _data);
 }
 
-} // namespace rd::vk
\ No newline at end of file
+} // namespace rd::vk
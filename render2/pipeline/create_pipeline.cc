@@ -5,6 +5,9 @@ import render.vk.resource;
 import render.vk.sync;
 import render.vk.device;
 import render.vk.shader_code;
+import render.vk.pipeline_cache;
+import render.vk.layout_cache;
+import render.vk.shader_reflection;
 import render.vertex;
 
 import std;
@@ -16,8 +19,8 @@ auto createShaderModule(std::string_view filename) -> rs::ShaderModule {
   auto content = get_shader_code(filename);
   auto create_info = VkShaderModuleCreateInfo{
     .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-    .codeSize = content.size(),
-    .pCode = reinterpret_cast<const uint32*>(content.data()),
+    .codeSize = content.size_bytes(),
+    .pCode = content.data(),
   };
   return rs::ShaderModule{ create_info };
 }
@@ -30,7 +33,7 @@ auto createGraphicsPipeline(
   std::string_view                                   frag_shader_name,
   std::span<const VkVertexInputBindingDescription>   vertex_binding_descriptions,
   std::span<const VkVertexInputAttributeDescription> vertex_attribute_descriptions,
-  std::span<const VkDescriptorSetLayout>             descriptor_set_layouts,
+  VkPipelineLayout                                   pipeline_layout,
   VkSampleCountFlagBits                              sample_count,
   std::optional<StencilOption>                       stencil_option
 ) -> PipelineResource {
@@ -181,14 +184,6 @@ auto createGraphicsPipeline(
     .pAttachments = &color_blend_attachment,
   };
 
-  // 指定 uniform 全局变量
-  auto pipeline_layout_info = VkPipelineLayoutCreateInfo{
-    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-    .setLayoutCount = (uint32)descriptor_set_layouts.size(),
-    .pSetLayouts = descriptor_set_layouts.data(),
-  };
-  auto pipeline_layout = rs::PipelineLayout{ pipeline_layout_info };
-
   auto pipeline_create_info = VkGraphicsPipelineCreateInfo{
     .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
     .stageCount = shader_stage_infos.size(),
@@ -210,55 +205,162 @@ auto createGraphicsPipeline(
   };
 
   auto pipeline = std::move(
-    rs::GraphicsPipelineFactory::create(VK_NULL_HANDLE, std::span{ &pipeline_create_info, 1 })[0]
+    rs::GraphicsPipelineFactory::create(
+      PipelineCache::getInstance(), std::span{ &pipeline_create_info, 1 }
+    )[0]
   );
   return { std::move(vertex_shader),
            std::move(frag_shader),
-           std::move(pipeline_layout),
+           pipeline_layout,
            std::move(pipeline) };
 }
 
-auto RenderPass::createPipeline(VkRenderPass render_pass, std::span<const SubpassInfo> subpasses)
-  -> std::vector<Pipeline> {
-  auto pipelines = std::vector<Pipeline>{};
-  for (auto const& subpass : subpasses) {
-    auto dset_layouts = std::vector<rs::DescriptorSetLayout>{};
-    auto dset_layout_handles = std::vector<VkDescriptorSetLayout>{};
-    for (auto const& dset_info : subpass.descriptor_sets) {
-      auto dset_layout = dset_info.descriptors | toy::enumerate | views::transform([](auto pair) {
-                           auto const& [index, info] = pair;
-                           return VkDescriptorSetLayoutBinding{
-                             .binding = index,
-                             .descriptorType = info.type,
-                             .descriptorCount = info.count,
-                             .stageFlags = info.stage,
-                             .pImmutableSamplers = nullptr,
-                           };
-                         }) |
-                         ranges::to<std::vector>();
-      auto dset_create_info = VkDescriptorSetLayoutCreateInfo{
-        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-        .bindingCount = static_cast<uint32>(dset_layout.size()),
-        .pBindings = dset_layout.data(),
-      };
-      dset_layouts.emplace_back(dset_create_info);
-      dset_layout_handles.push_back(dset_layouts.back());
+/**
+ * @brief the descriptor sets and push constants given by subpass, or reflected from the shaders
+ */
+auto getSubpassInterface(SubpassInfo const& subpass) -> PipelineReflection {
+  auto reflections = std::array{
+    reflectShader(get_shader_code(subpass.vertex_shader_name)),
+    reflectShader(get_shader_code(subpass.frag_shader_name)),
+  };
+  auto reflection = mergeReflections(reflections);
+  for (auto const& input : reflection.vertex_inputs) {
+    auto attributes = subpass.vertex_info.attribute_descriptions;
+    toy::throwf(
+      ranges::find(attributes, input.location, &VkVertexInputAttributeDescription::location) !=
+        attributes.end(),
+      "the vertex input location {} of {} has no attribute",
+      input.location,
+      subpass.vertex_shader_name
+    );
+  }
+  if (!subpass.descriptor_sets.empty()) {
+    reflection.sets =
+      subpass.descriptor_sets | views::transform([](DescriptorSetInfo const& dset_info) {
+        return dset_info.descriptors | toy::enumerate | views::transform([](auto pair) {
+                 auto const& [index, info] = pair;
+                 return VkDescriptorSetLayoutBinding{
+                   .binding = index,
+                   .descriptorType = info.type,
+                   .descriptorCount = info.count,
+                   .stageFlags = info.stage,
+                   .pImmutableSamplers = nullptr,
+                 };
+               }) |
+               ranges::to<std::vector>();
+      }) |
+      ranges::to<std::vector>();
+  }
+  if (!subpass.push_constants.empty()) {
+    for (auto const& range : reflection.push_constants) {
+      toy::throwf(
+        ranges::any_of(
+          subpass.push_constants,
+          [&](VkPushConstantRange const& declared) {
+            return (declared.stageFlags & range.stageFlags) == range.stageFlags &&
+                   declared.offset <= range.offset &&
+                   range.offset + range.size <= declared.offset + declared.size;
+          }
+        ),
+        "the push constant range [{}, {}) used by shaders is not declared",
+        range.offset,
+        range.offset + range.size
+      );
     }
-    pipelines.emplace_back(
-      createGraphicsPipeline(
-        render_pass,
-        subpass.topology,
-        subpass.vertex_shader_name,
-        subpass.frag_shader_name,
-        { subpass.vertex_info.binding_description, 1 },
-        subpass.vertex_info.attribute_descriptions,
-        dset_layout_handles,
-        subpass.multi_sample.transform([](auto x) { return x.sample_count; }
-        ).value_or(VK_SAMPLE_COUNT_1_BIT),
-        subpass.depst_info.transform([](auto x) { return x.stencil_option; })
-      ),
-      std::move(dset_layouts)
+    reflection.push_constants = subpass.push_constants;
+  }
+  for (auto [set, binding] : subpass.dynamic_uniforms) {
+    auto bindings = set < reflection.sets.size() ? std::span{ reflection.sets[set] }
+                                                 : std::span<VkDescriptorSetLayoutBinding>{};
+    auto iter = ranges::find(bindings, binding, &VkDescriptorSetLayoutBinding::binding);
+    toy::throwf(
+      iter != bindings.end() && iter->descriptorType == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+      "the binding {} of set {} is not a uniform buffer",
+      binding,
+      set
     );
+    iter->descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+  }
+  return reflection;
+}
+
+auto createSubpassPipeline(VkRenderPass render_pass, SubpassInfo const& subpass) -> Pipeline {
+  auto  reflection = getSubpassInterface(subpass);
+  auto& layout_cache = LayoutCache::getInstance();
+  auto  dset_layouts = reflection.sets | views::transform([&](auto const& bindings) {
+                        return layout_cache.getDescriptorSetLayout(bindings);
+                      }) |
+                      ranges::to<std::vector>();
+  auto pipeline_layout = layout_cache.getPipelineLayout(dset_layouts, reflection.push_constants);
+  return Pipeline{
+    createGraphicsPipeline(
+      render_pass,
+      subpass.topology,
+      subpass.vertex_shader_name,
+      subpass.frag_shader_name,
+      subpass.vertex_info.binding_descriptions,
+      subpass.vertex_info.attribute_descriptions,
+      pipeline_layout,
+      subpass.multi_sample.transform([](auto x) { return x.sample_count; }
+      ).value_or(VK_SAMPLE_COUNT_1_BIT),
+      subpass.depst_info.transform([](auto x) { return x.stencil_option; })
+    ),
+    std::move(dset_layouts),
+    std::move(reflection.push_constants)
+  };
+}
+
+ComputePipeline::ComputePipeline(std::string_view shader_name) {
+  auto reflections = std::array{ reflectShader(get_shader_code(shader_name)) };
+  toy::throwf(
+    reflections[0].stage == VK_SHADER_STAGE_COMPUTE_BIT, "{} is not a compute shader", shader_name
+  );
+  auto  reflection = mergeReflections(reflections);
+  auto& layout_cache = LayoutCache::getInstance();
+  _dset_layouts = reflection.sets | views::transform([&](auto const& bindings) {
+                    return layout_cache.getDescriptorSetLayout(bindings);
+                  }) |
+                  ranges::to<std::vector>();
+  _push_constants = std::move(reflection.push_constants);
+  _pipeline_layout = layout_cache.getPipelineLayout(_dset_layouts, _push_constants);
+
+  auto shader = createShaderModule(shader_name);
+  auto create_info = VkComputePipelineCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+    .stage = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+      .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+      .module = shader,
+      .pName = "main",
+    },
+    .layout = _pipeline_layout,
+  };
+  // the shader module is not needed after the pipeline is created
+  auto pipelines =
+    rs::ComputePipelineFactory::create(PipelineCache::getInstance(), std::span{ &create_info, 1 });
+  _pipeline = std::move(pipelines[0]);
+}
+
+auto RenderPass::createPipeline(VkRenderPass render_pass, std::span<const SubpassInfo> subpasses)
+  -> std::vector<PendingPipeline> {
+  auto& thread_pool = toy::ThreadPool::getInstance();
+  auto  pipelines = std::vector<PendingPipeline>{};
+  for (auto const& [index, subpass] : subpasses | toy::enumerate) {
+    // the job owns a copy of subpass info, since info may be destroyed before the job runs.
+    // vkCreateGraphicsPipelines synchronizes the shared pipeline cache internally, so the jobs need
+    // no lock, and the cache outlives the thread pool
+    pipelines.emplace_back(thread_pool.submit([render_pass, index, subpass]() {
+      auto begin = chrono::steady_clock::now();
+      auto pipeline = createSubpassPipeline(render_pass, subpass);
+      // compare the time with and without a loaded blob to see the effect of pipeline cache
+      toy::debugf(
+        "create pipeline of subpass {} in {} (pipeline cache loaded {} bytes)",
+        index,
+        chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin),
+        PipelineCache::getInstance().getLoadedSize()
+      );
+      return pipeline;
+    }));
   }
   return pipelines;
 }
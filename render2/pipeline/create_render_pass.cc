@@ -424,6 +424,7 @@ auto RenderPass::createRenderPass(
       .final_stage = final_stage,
       .initial_layout = attachment_descs[index].initialLayout,
       .final_layout = attachment_descs[index].finalLayout,
+      .keep_old_content = attachments[index].keep_old_content,
     });
   }
   toy::debugf("the attachment sync infos: ");
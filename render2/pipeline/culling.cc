@@ -0,0 +1,168 @@
+module render.vk.culling;
+
+import std;
+import toy;
+import glm;
+
+import "vulkan_config.h";
+import render.vk.device;
+import render.vk.buffer;
+import render.vk.sync;
+import render.vk.executor;
+import render.vk.upload;
+import render.vk.render_pass;
+
+namespace rd::vk {
+
+auto device_checkers::indirect(DeviceCapabilityBuilder& builder) -> bool {
+  // a non-zero draw count buffer, more than one draw per call and a non-zero first instance
+  return builder.enableFeature(&VkPhysicalDeviceVulkan12Features::drawIndirectCount) &&
+         builder.enableFeature(&VkPhysicalDeviceFeatures::multiDrawIndirect) &&
+         builder.enableFeature(&VkPhysicalDeviceFeatures::drawIndirectFirstInstance);
+}
+
+constexpr auto object_scope = Scope{
+  .stage_mask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+  .access_mask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT,
+};
+
+// the array stride of std430, the struct is aligned to its vec4
+static_assert(sizeof(CullObject) == 48);
+
+GpuCulling::GpuCulling(uint32 max_object_count, uint32 group_count)
+  : _max_object_count(max_object_count), _groups(group_count), _pipeline("cull.comp"),
+    _dset_pool(1, std::array{ VkDescriptorPoolSize{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 } }),
+    _dset(_dset_pool, _pipeline, 0),
+    _object_buffer(
+      sizeof(CullObject) * std::max(max_object_count, 1u),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+    ),
+    _command_buffer(
+      sizeof(VkDrawIndexedIndirectCommand) * std::max(max_object_count, 1u),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+    ),
+    _count_buffer(
+      sizeof(uint32) * std::max(group_count, 1u),
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+    ) {
+  _dset[0] = StorageRange{ _object_buffer };
+  _dset[1] = StorageRange{ _command_buffer };
+  _dset[2] = StorageRange{ _count_buffer };
+}
+
+void GpuCulling::setObjects(std::span<const CullObject> objects, UploadBatch& batch) {
+  toy::throwf(
+    objects.size() <= _max_object_count,
+    "{} objects exceed the capacity {} of culling",
+    objects.size(),
+    _max_object_count
+  );
+  toy::throwf(
+    batch.getDstFamily() == CommandExecutorManager::getInstance()[FamilyType::COMPUTE].getFamily(),
+    "the objects of culling must be uploaded to the compute family"
+  );
+  ranges::fill(_groups, Group{});
+  // the commands of a group are written to the range of its objects
+  auto group_objects = std::vector<CullObject>(objects.begin(), objects.end());
+  for (auto i : views::iota(0u, static_cast<uint32>(group_objects.size()))) {
+    auto& object = group_objects[i];
+    toy::throwf(
+      object.group < _groups.size(), "group {} exceeds the count {}", object.group, _groups.size()
+    );
+    toy::throwf(
+      i == 0 || group_objects[i - 1].group <= object.group, "the objects are not sorted by group"
+    );
+    auto& group = _groups[object.group];
+    if (group.object_count == 0) {
+      group.first_object = i;
+    }
+    group.object_count++;
+    object.first_command = group.first_object;
+  }
+  _object_count = objects.size();
+  if (!objects.empty()) {
+    batch.uploadBuffer(_object_buffer, std::as_bytes(std::span{ group_objects }), object_scope);
+  }
+}
+
+void GpuCulling::recordCulling(
+  VkCommandBuffer                  cmdbuf,
+  std::array<glm::vec4, 6> const& frustum_planes,
+  uint32                           first_object,
+  uint32                           object_count
+) {
+  first_object = std::min(first_object, _object_count);
+  object_count = std::min(object_count, _object_count - first_object);
+  // the draws and the culling of last frame must be complete before the buffers are written again
+  auto reuse_barrier = VkMemoryBarrier2{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+    .srcStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    .dstStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+  };
+  recordPipelineBarrier(cmdbuf, { &reuse_barrier, 1 }, {}, {});
+  // the groups out of the range keep no draw
+  vkCmdFillBuffer(cmdbuf, _count_buffer, 0, VK_WHOLE_SIZE, 0);
+  auto clear_barrier = VkMemoryBarrier2{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+    .srcStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT,
+    .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+    .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+    .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+                     VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+  };
+  recordPipelineBarrier(cmdbuf, { &clear_barrier, 1 }, {}, {});
+
+  if (object_count > 0) {
+    auto constants = CullConstants{
+      .planes = frustum_planes,
+      .first_object = first_object,
+      .object_count = object_count,
+    };
+    auto dset = _dset.get();
+    vkCmdBindPipeline(cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline.pipeline());
+    vkCmdBindDescriptorSets(
+      cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline.pipeline_layout(), 0, 1, &dset, 0, nullptr
+    );
+    vkCmdPushConstants(
+      cmdbuf,
+      _pipeline.pipeline_layout(),
+      VK_SHADER_STAGE_COMPUTE_BIT,
+      0,
+      sizeof(CullConstants),
+      &constants
+    );
+    vkCmdDispatch(cmdbuf, (object_count + local_size - 1) / local_size, 1, 1);
+  }
+
+  auto draw_barrier = VkMemoryBarrier2{
+    .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+    .srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+    .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+    .dstStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+    .dstAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+  };
+  recordPipelineBarrier(cmdbuf, { &draw_barrier, 1 }, {}, {});
+}
+
+void GpuCulling::recordDraw(Pipeline::Recorder& recorder, uint32 group) {
+  toy::throwf(group < _groups.size(), "draw group {} of {}", group, _groups.size());
+  auto const& [first_object, object_count] = _groups[group];
+  if (object_count == 0) {
+    return;
+  }
+  recorder.drawIndexedIndirectCount(
+    _command_buffer,
+    _count_buffer,
+    object_count,
+    first_object * sizeof(VkDrawIndexedIndirectCommand),
+    group * sizeof(uint32)
+  );
+}
+
+} // namespace rd::vk
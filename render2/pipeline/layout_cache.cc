@@ -0,0 +1,91 @@
+module render.vk.layout_cache;
+
+import std;
+import toy;
+
+import "vulkan_config.h";
+import render.vk.resource;
+
+namespace rd::vk {
+
+LayoutCache::~LayoutCache() {
+  // pipeline layouts refer to the set layouts
+  _pipeline_layouts.clear();
+  _set_layouts.clear();
+  toy::debugf(
+    "layout cache: {} of {} set layouts and {} of {} pipeline layouts are created",
+    _statistics.set_layout_count,
+    _statistics.set_layout_requests,
+    _statistics.pipeline_layout_count,
+    _statistics.pipeline_layout_requests
+  );
+}
+
+auto LayoutCache::KeyHash::operator()(Key const& key) const -> size_t {
+  auto hash = size_t{ 0xcbf29ce484222325 };
+  for (auto word : key) {
+    hash ^= std::hash<uint64>{}(word) + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+  }
+  return hash;
+}
+
+auto LayoutCache::getDescriptorSetLayout(std::span<const VkDescriptorSetLayoutBinding> bindings)
+  -> VkDescriptorSetLayout {
+  auto key = Key{};
+  for (auto const& binding : bindings) {
+    toy::throwf(binding.pImmutableSamplers == nullptr, "immutable samplers are not supported");
+    key.push_back(uint64{ binding.binding } << 32 | binding.descriptorType);
+    key.push_back(uint64{ binding.descriptorCount } << 32 | binding.stageFlags);
+  }
+  auto lock = std::scoped_lock{ _mutex };
+  _statistics.set_layout_requests++;
+  auto iter = _set_layouts.find(key);
+  if (iter == _set_layouts.end()) {
+    auto create_info = VkDescriptorSetLayoutCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .bindingCount = static_cast<uint32>(bindings.size()),
+      .pBindings = bindings.data(),
+    };
+    iter = _set_layouts.emplace(std::move(key), rs::DescriptorSetLayout{ create_info }).first;
+    _statistics.set_layout_count++;
+  }
+  return iter->second;
+}
+
+auto LayoutCache::getPipelineLayout(
+  std::span<const VkDescriptorSetLayout> set_layouts,
+  std::span<const VkPushConstantRange>   push_constants
+) -> VkPipelineLayout {
+  // set layouts are deduplicated, so the handles identify their content
+  auto key = Key{};
+  key.push_back(set_layouts.size());
+  for (auto set_layout : set_layouts) {
+    key.push_back(std::bit_cast<uint64>(set_layout));
+  }
+  for (auto const& range : push_constants) {
+    key.push_back(uint64{ range.stageFlags } << 32 | range.offset);
+    key.push_back(range.size);
+  }
+  auto lock = std::scoped_lock{ _mutex };
+  _statistics.pipeline_layout_requests++;
+  auto iter = _pipeline_layouts.find(key);
+  if (iter == _pipeline_layouts.end()) {
+    auto create_info = VkPipelineLayoutCreateInfo{
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+      .setLayoutCount = static_cast<uint32>(set_layouts.size()),
+      .pSetLayouts = set_layouts.data(),
+      .pushConstantRangeCount = static_cast<uint32>(push_constants.size()),
+      .pPushConstantRanges = push_constants.data(),
+    };
+    iter = _pipeline_layouts.emplace(std::move(key), rs::PipelineLayout{ create_info }).first;
+    _statistics.pipeline_layout_count++;
+  }
+  return iter->second;
+}
+
+auto LayoutCache::getStatistics() -> Statistics {
+  auto lock = std::scoped_lock{ _mutex };
+  return _statistics;
+}
+
+} // namespace rd::vk
@@ -0,0 +1,91 @@
+module render.vk.pipeline_cache;
+
+import std;
+import toy;
+
+import "vulkan_config.h";
+import render.vk.tool;
+import render.vk.device;
+
+namespace rd::vk {
+
+auto isPipelineCacheCompatible(
+  std::span<std::byte const> data, VkPhysicalDeviceProperties const& properties
+) -> bool {
+  auto header = VkPipelineCacheHeaderVersionOne{};
+  if (data.size() < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, data.data(), sizeof(header));
+  return header.headerSize >= sizeof(header) &&
+         header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+         header.vendorID == properties.vendorID && header.deviceID == properties.deviceID &&
+         ranges::equal(header.pipelineCacheUUID, properties.pipelineCacheUUID);
+}
+
+auto readPipelineCacheFile(std::filesystem::path const& path) -> std::vector<std::byte> {
+  auto file = std::ifstream{ path, std::ios::binary | std::ios::ate };
+  if (!file) {
+    return {};
+  }
+  auto data = std::vector<std::byte>(static_cast<size_t>(file.tellg()));
+  file.seekg(0);
+  file.read(reinterpret_cast<char*>(data.data()), data.size());
+  if (!file) {
+    return {};
+  }
+  return data;
+}
+
+PipelineCache::PipelineCache(std::filesystem::path path) : _path(std::move(path)) {
+  auto begin = chrono::steady_clock::now();
+  auto data = readPipelineCacheFile(_path);
+  if (!data.empty() &&
+      !isPipelineCacheCompatible(data, Device::getInstance().getPdevice().getProperties())) {
+    toy::debugf("drop pipeline cache {}: created by other device or driver", _path.string());
+    data.clear();
+  }
+  auto create_info = VkPipelineCacheCreateInfo{
+    .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+    .initialDataSize = data.size(),
+    .pInitialData = data.data(),
+  };
+  _cache = rs::PipelineCache{ create_info };
+  _loaded_size = data.size();
+  toy::debugf(
+    "load pipeline cache {} ({} bytes) in {}",
+    _path.string(),
+    _loaded_size,
+    chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - begin)
+  );
+}
+
+PipelineCache::~PipelineCache() {
+  try {
+    save();
+  } catch (std::exception const& e) {
+    toy::debugf("save pipeline cache failed: {}", e.what());
+  }
+}
+
+void PipelineCache::save() {
+  auto device = static_cast<VkDevice>(Device::getInstance());
+  auto size = size_t{};
+  checkVkResult(vkGetPipelineCacheData(device, _cache, &size, nullptr), "get pipeline cache size");
+  auto data = std::vector<std::byte>(size);
+  checkVkResult(
+    vkGetPipelineCacheData(device, _cache, &size, data.data()), "get pipeline cache data"
+  );
+
+  auto temp_path = _path;
+  temp_path += ".tmp";
+  auto file = std::ofstream{ temp_path, std::ios::binary | std::ios::trunc };
+  file.write(reinterpret_cast<char const*>(data.data()), size);
+  file.close();
+  toy::throwf(file.good(), "write pipeline cache {} failed", temp_path.string());
+  // replace the old blob at once
+  std::filesystem::rename(temp_path, _path);
+  toy::debugf("save pipeline cache {} ({} bytes)", _path.string(), size);
+}
+
+} // namespace rd::vk
@@ -0,0 +1,287 @@
+module render.vk.render_graph;
+
+import std;
+import toy;
+
+import "vulkan_config.h";
+import render.vk.tool;
+import render.vk.device;
+import render.vk.allocator;
+import render.vk.image;
+
+namespace rd::vk {
+
+auto RenderGraph::importImage(VkExtent2D extent) -> ImageHandle {
+  _images.push_back(ImageNode{ .extent = extent });
+  _compiled = false;
+  return ImageHandle{ static_cast<uint32>(_images.size() - 1) };
+}
+
+void RenderGraph::setImportedImage(
+  ImageHandle handle, ImageBarrierTracker* tracker, VkImageView image_view
+) {
+  auto& image = _images.at(handle.index);
+  toy::throwf(!image.info.has_value(), "the image {} is not imported", handle.index);
+  image.tracker = tracker;
+  image.image_view = image_view;
+}
+
+auto RenderGraph::createImage(TransientImageInfo const& info) -> ImageHandle {
+  _images.push_back(ImageNode{ .info = info, .extent = info.extent });
+  _compiled = false;
+  return ImageHandle{ static_cast<uint32>(_images.size() - 1) };
+}
+
+void RenderGraph::addPass(GraphPass pass) {
+  _passes.push_back(PassNode{ .pass = std::move(pass) });
+  _compiled = false;
+}
+
+void RenderGraph::addRenderPass(
+  std::string                   name,
+  RenderPass&                   render_pass,
+  std::vector<ImageHandle>      attachments,
+  std::span<VkClearValue const> clear_values
+) {
+  auto syncs = render_pass.getAttachmentSyncs();
+  toy::throwf(attachments.size() == syncs.size(), "mismatched attachment count");
+  auto pass = GraphPass{ .name = std::move(name) };
+  for (auto [handle, sync] : views::zip(attachments, syncs)) {
+    // the render pass transitions the attachment to final layout by itself
+    pass.images.push_back(ImageAccess{
+      .image = handle,
+      .begin = { Scope{ .stage_mask = sync.initial_stage }, sync.initial_layout },
+      .end = ImageState{ Scope{ .stage_mask = sync.final_stage }, sync.final_layout },
+      .read = sync.keep_old_content,
+      .write = true,
+    });
+  }
+  auto index = _passes.size();
+  pass.recorder = [this, index](VkCommandBuffer cmdbuf) {
+    recordRenderPass(cmdbuf, _passes[index]);
+  };
+  _passes.push_back(PassNode{
+    .pass = std::move(pass),
+    .render_pass = &render_pass,
+    .attachments = std::move(attachments),
+    .clear_values = clear_values | ranges::to<std::vector>(),
+  });
+  _compiled = false;
+}
+
+void RenderGraph::compile() {
+  cullPasses();
+  computeLifetimes();
+  createTransientImages();
+  _compiled = true;
+  toy::debugf(
+    "render graph: {} passes ({} culled), {} transient images use {} bytes (unaliased {} bytes)",
+    _statistics.pass_count,
+    _statistics.culled_pass_count,
+    _statistics.transient_image_count,
+    _statistics.transient_memory_size,
+    _statistics.unaliased_memory_size
+  );
+}
+
+void RenderGraph::cullPasses() {
+  // the images whose content is read by later live passes
+  auto needed = std::vector<bool>(_images.size(), false);
+  for (auto& node : _passes | views::reverse) {
+    node.live = node.pass.side_effect || ranges::any_of(node.pass.images, [&](auto& access) {
+                  auto imported = !_images[access.image.index].info.has_value();
+                  return access.write && (imported || needed[access.image.index]);
+                });
+    if (!node.live) {
+      continue;
+    }
+    // the content is produced by this pass, so the writes before are not needed, unless this pass
+    // reads them
+    for (auto& access : node.pass.images | views::filter(&ImageAccess::write)) {
+      needed[access.image.index] = false;
+    }
+    for (auto& access : node.pass.images | views::filter(&ImageAccess::read)) {
+      needed[access.image.index] = true;
+    }
+  }
+  _statistics.pass_count = _passes.size();
+  _statistics.culled_pass_count = ranges::count(_passes, false, &PassNode::live);
+}
+
+void RenderGraph::computeLifetimes() {
+  for (auto& image : _images) {
+    image.lifetime.reset();
+  }
+  for (auto index : views::iota(0u, _passes.size())) {
+    if (!_passes[index].live) {
+      continue;
+    }
+    for (auto& access : _passes[index].pass.images) {
+      auto& lifetime = _images[access.image.index].lifetime;
+      if (lifetime.has_value()) {
+        lifetime->second = index;
+      } else {
+        lifetime = { index, index };
+      }
+    }
+  }
+}
+
+void RenderGraph::createTransientImages() {
+  // the framebuffers may refer to the old transient images
+  for (auto& node : _passes) {
+    node.framebuffers.clear();
+  }
+  for (auto& image : _images) {
+    if (image.transient == nullptr) {
+      continue;
+    }
+    image.transient.reset();
+    image.tracker = nullptr;
+    image.image_view = VK_NULL_HANDLE;
+  }
+  _memories.clear();
+
+  struct MemoryGroup {
+    VkMemoryRequirements requirements;
+    // the last pass that uses the memory
+    uint32 last_pass;
+  };
+  auto groups = std::vector<MemoryGroup>{};
+  auto indices = views::iota(0u, _images.size()) | views::filter([&](uint32 index) {
+                   return _images[index].info.has_value() && _images[index].lifetime.has_value();
+                 }) |
+                 ranges::to<std::vector>();
+  ranges::sort(indices, {}, [&](uint32 index) { return _images[index].lifetime->first; });
+  _statistics.transient_image_count = indices.size();
+  _statistics.unaliased_memory_size = 0;
+  for (auto index : indices) {
+    auto& image = _images[index];
+    auto& info = *image.info;
+    image.transient = std::make_unique<TransientImage>();
+    image.transient->image = createImage(
+      info.format, info.extent.width, info.extent.height, info.usage, 1, info.sample_count
+    );
+    auto requirements = VkMemoryRequirements{};
+    vkGetImageMemoryRequirements(Device::getInstance(), image.transient->image, &requirements);
+    _statistics.unaliased_memory_size += requirements.size;
+
+    // images are placed in order of first use, so an image can reuse the memory whose last user
+    // is complete before the image is first used
+    auto [first_pass, last_pass] = *image.lifetime;
+    auto group = ranges::find_if(groups, [&](MemoryGroup const& group) {
+      return group.last_pass < first_pass &&
+             (group.requirements.memoryTypeBits & requirements.memoryTypeBits) != 0;
+    });
+    if (group == groups.end()) {
+      groups.push_back(MemoryGroup{ requirements, last_pass });
+      image.memory_index = groups.size() - 1;
+      continue;
+    }
+    group->requirements.size = std::max(group->requirements.size, requirements.size);
+    group->requirements.alignment =
+      std::max(group->requirements.alignment, requirements.alignment);
+    group->requirements.memoryTypeBits &= requirements.memoryTypeBits;
+    group->last_pass = last_pass;
+    image.memory_index = group - groups.begin();
+  }
+
+  _statistics.transient_memory_size = 0;
+  for (auto& group : groups) {
+    auto memory =
+      Memory{ group.requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, ResourceTiling::OPTIMAL };
+    _memories.push_back(MemoryNode{ .memory = std::move(memory), .last_scope = {} });
+    _statistics.transient_memory_size += group.requirements.size;
+  }
+  for (auto index : indices) {
+    auto& image = _images[index];
+    auto& info = *image.info;
+    auto& transient = *image.transient;
+    auto& memory = _memories[image.memory_index].memory;
+    checkVkResult(
+      vkBindImageMemory(Device::getInstance(), transient.image, memory.get(), memory.offset()),
+      "bind image memory"
+    );
+    transient.image_view = createImageView(transient.image, info.format, info.aspect, 1);
+    transient.tracker =
+      ImageBarrierTracker{ transient.image, getSubresourceRange(info.aspect, { 0, 1 }) };
+    image.tracker = &transient.tracker;
+    image.image_view = transient.image_view;
+  }
+}
+
+void RenderGraph::execute() {
+  if (!_compiled) {
+    compile();
+  }
+  auto& executor = CommandExecutorManager::getInstance()[_family_type];
+  auto  family = executor.getFamily();
+  for (auto index : views::iota(0u, _passes.size())) {
+    auto& node = _passes[index];
+    if (!node.live) {
+      continue;
+    }
+    // barriers of all images used by the pass are merged into one pipeline barrier
+    auto barriers = BarrierBatch{};
+    for (auto& access : node.pass.images) {
+      auto& image = _images[access.image.index];
+      toy::throwf(
+        image.tracker != nullptr,
+        "the image {} used by pass {} is not set",
+        access.image.index,
+        node.pass.name
+      );
+      if (image.transient && image.lifetime->first == index) {
+        // the content of transient image is discarded, but the image must wait the last image
+        // that used the same memory
+        auto& last_scope = _memories[image.memory_index].last_scope;
+        if (last_scope.stage_mask != 0) {
+          image.tracker->setNewScope(last_scope, family, VK_IMAGE_LAYOUT_UNDEFINED);
+        }
+      }
+      image.tracker->syncScope(access.begin.scope, family, access.begin.layout, barriers);
+    }
+    // ownership transfer needs its own submissions
+    if (!barriers.getReleaseFamilies().empty()) {
+      barriers.submit(executor);
+    }
+    executor.submit([&](VkCommandBuffer cmdbuf) {
+      barriers.recordAcquire(cmdbuf, family);
+      node.pass.recorder(cmdbuf);
+    });
+    for (auto& access : node.pass.images) {
+      auto& image = _images[access.image.index];
+      if (access.end.has_value()) {
+        image.tracker->setNewScope(access.end->scope, family, access.end->layout);
+      }
+      if (image.transient) {
+        _memories[image.memory_index].last_scope = image.tracker->getNowScope();
+      }
+    }
+  }
+}
+
+void RenderGraph::reset() {
+  // framebuffers and images must be destroyed before the memories
+  _passes.clear();
+  _images.clear();
+  _memories.clear();
+  _compiled = false;
+  _statistics = {};
+}
+
+void RenderGraph::recordRenderPass(VkCommandBuffer cmdbuf, PassNode& node) {
+  auto image_views = node.attachments |
+                     views::transform([&](ImageHandle handle) { return getImageView(handle); }) |
+                     ranges::to<std::vector>();
+  auto iter = node.framebuffers.find(image_views);
+  if (iter == node.framebuffers.end()) {
+    auto extent = _images[node.attachments.front().index].extent;
+    iter = node.framebuffers
+             .emplace(image_views, Framebuffer{ *node.render_pass, extent, image_views })
+             .first;
+  }
+  node.render_pass->recordDraw(cmdbuf, iter->second, node.clear_values);
+}
+
+} // namespace rd::vk
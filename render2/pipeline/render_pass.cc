@@ -20,10 +20,7 @@ DescriptorPool::DescriptorPool(
   rs::DescriptorPool::operator=({ pool_create_info });
 }
 
-DescriptorSet::DescriptorSet(
-  const DescriptorPool& pool, const Pipeline& pipeline, uint32 set_id
-) {
-  auto dset_layout = pipeline.descriptor_set_layouts()[set_id].get();
+DescriptorSet::DescriptorSet(const DescriptorPool& pool, VkDescriptorSetLayout dset_layout) {
   auto allocate_info = VkDescriptorSetAllocateInfo{
     .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
     .descriptorPool = pool,
@@ -81,6 +78,45 @@ auto Descriptor::operator=(
   return *this;
 }
 
+auto Descriptor::operator=(UniformRange range) -> Descriptor& {
+  // the offset is added by the dynamic offset when binding
+  auto buffer_info = VkDescriptorBufferInfo{
+    .buffer = range.buffer,
+    .offset = 0,
+    .range = range.range,
+  };
+  auto write_info = VkWriteDescriptorSet{
+    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+    .dstSet = _dset->get(),
+    .dstBinding = _binding,
+    .dstArrayElement = 0,
+    .descriptorCount = 1,
+    .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+    .pBufferInfo = &buffer_info,
+  };
+  vkUpdateDescriptorSets(Device::getInstance(), 1, &write_info, 0, nullptr);
+  return *this;
+}
+
+auto Descriptor::operator=(StorageRange range) -> Descriptor& {
+  auto buffer_info = VkDescriptorBufferInfo{
+    .buffer = range.buffer,
+    .offset = range.offset,
+    .range = range.range,
+  };
+  auto write_info = VkWriteDescriptorSet{
+    .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+    .dstSet = _dset->get(),
+    .dstBinding = _binding,
+    .dstArrayElement = 0,
+    .descriptorCount = 1,
+    .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+    .pBufferInfo = &buffer_info,
+  };
+  vkUpdateDescriptorSets(Device::getInstance(), 1, &write_info, 0, nullptr);
+  return *this;
+}
+
 Framebuffer::Framebuffer(
   RenderPass& render_pass, VkExtent2D extent, std::span<const VkImageView> image_views
 ) {
@@ -98,7 +134,22 @@ Framebuffer::Framebuffer(
 }
 
 void Pipeline::Recorder::init() {
-  vkCmdBindPipeline(_cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline);
+  vkCmdBindPipeline(_cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, _pipeline.pipeline());
+  // the layouts are deduplicated by LayoutCache, so the set n is still valid if the set layouts
+  // 0..n and the push constant ranges have the same handles and content
+  auto& bound = _bound_sets;
+  auto  set_layouts = _pipeline.descriptor_set_layouts();
+  auto  push_constants = _pipeline.push_constant_ranges();
+  auto  compatible_count = size_t{ 0 };
+  if (ranges::equal(bound.push_constants, push_constants, [](auto& a, auto& b) {
+        return a.stageFlags == b.stageFlags && a.offset == b.offset && a.size == b.size;
+      })) {
+    compatible_count = ranges::mismatch(bound.layouts, set_layouts).in1 - bound.layouts.begin();
+  }
+  bound.sets.resize(std::min(bound.sets.size(), compatible_count));
+  bound.layouts.assign(set_layouts.begin(), set_layouts.end());
+  bound.push_constants.assign(push_constants.begin(), push_constants.end());
+
   // 定义了 viewport 到缓冲区的变换
   VkViewport viewport{
     .x = 0,
@@ -117,12 +168,53 @@ void Pipeline::Recorder::init() {
   vkCmdSetScissor(_cmdbuf, 0, 1, &scissor);
 }
 
-void Pipeline::Recorder::draw() { vkCmdDrawIndexed(_cmdbuf, _index_count, 1, 0, 0, 0); }
+void Pipeline::Recorder::draw() {
+  toy::throwf(_index_count > 0, "draw the whole index buffer, but it has no index number");
+  vkCmdDrawIndexed(_cmdbuf, _index_count, 1, 0, 0, 0);
+}
+
+void Pipeline::Recorder::drawInstanced(uint32 instance_count, uint32 first_instance) {
+  toy::throwf(_index_count > 0, "draw the whole index buffer, but it has no index number");
+  vkCmdDrawIndexed(_cmdbuf, _index_count, instance_count, 0, 0, first_instance);
+}
+
+void Pipeline::Recorder::drawIndexedIndirectCount(
+  VkBuffer     command_buffer,
+  VkBuffer     count_buffer,
+  uint32       max_draw_count,
+  VkDeviceSize command_offset,
+  VkDeviceSize count_offset
+) {
+  vkCmdDrawIndexedIndirectCount(
+    _cmdbuf,
+    command_buffer,
+    command_offset,
+    count_buffer,
+    count_offset,
+    max_draw_count,
+    sizeof(VkDrawIndexedIndirectCommand)
+  );
+}
+
+void Pipeline::Recorder::drawIndexedIndirect(VkBuffer command_buffer, uint32 draw_count) {
+  vkCmdDrawIndexedIndirect(
+    _cmdbuf, command_buffer, 0, draw_count, sizeof(VkDrawIndexedIndirectCommand)
+  );
+}
 
-auto Pipeline::Recorder::DescriptorSetBinding::DescriptorSetBindingTarget::operator=(
-  DescriptorSet& descriptor_set
-) -> DescriptorSetBindingTarget& {
-  auto handle = descriptor_set.get();
+void Pipeline::Recorder::DescriptorSetBinding::DescriptorSetBindingTarget::bind(
+  DescriptorSet& descriptor_set, std::span<const uint32> dynamic_offsets
+) {
+  auto  handle = descriptor_set.get();
+  auto& bound_sets = _parent->_bound_sets->sets;
+  // the set with dynamic offsets is bound every time, since the offsets may change
+  if (dynamic_offsets.empty() && _index < bound_sets.size() && bound_sets[_index] == handle) {
+    return;
+  }
+  if (bound_sets.size() <= _index) {
+    bound_sets.resize(_index + 1, VK_NULL_HANDLE);
+  }
+  bound_sets[_index] = handle;
   vkCmdBindDescriptorSets(
     _parent->_cmdbuf,
     VK_PIPELINE_BIND_POINT_GRAPHICS,
@@ -131,18 +223,23 @@ auto Pipeline::Recorder::DescriptorSetBinding::DescriptorSetBindingTarget::opera
     _index,
     1,
     &handle,
-    0,
-    nullptr
+    static_cast<uint32>(dynamic_offsets.size()),
+    dynamic_offsets.data()
   );
-  return *this;
 }
 
-auto Pipeline::Recorder::VertexBufferBinding::operator=(VertexBuffer& vertex_buffer
-) -> VertexBufferBinding& {
-  auto offset = VkDeviceSize{ 0 };
-  auto buffer = vertex_buffer.get();
-  vkCmdBindVertexBuffers(_cmdbuf, 0, 1, &buffer, &offset);
-  return *this;
+void Pipeline::Recorder::VertexBufferBinding::bind(std::span<VertexBuffer* const> vertex_buffers) {
+  auto buffers = std::vector<VkBuffer>{};
+  auto offsets = std::vector<VkDeviceSize>{};
+  for (auto* vertex_buffer : vertex_buffers) {
+    for (auto offset : vertex_buffer->getStreamOffsets()) {
+      buffers.push_back(vertex_buffer->get());
+      offsets.push_back(offset);
+    }
+  }
+  vkCmdBindVertexBuffers(
+    _cmdbuf, 0, static_cast<uint32>(buffers.size()), buffers.data(), offsets.data()
+  );
 }
 
 auto Pipeline::Recorder::IndexBufferBinding::operator=(IndexBuffer& index_buffer
@@ -152,6 +249,33 @@ auto Pipeline::Recorder::IndexBufferBinding::operator=(IndexBuffer& index_buffer
   return *this;
 }
 
+void Pipeline::Recorder::PushConstantBinding::push(
+  uint32 offset, std::span<const std::byte> data
+) {
+  auto end = offset + static_cast<uint32>(data.size());
+  // every stage whose range overlaps the data must be given, and each of them must cover the data
+  auto stages = VkShaderStageFlags{ 0 };
+  for (auto const& range : _pipeline->push_constant_ranges()) {
+    if (range.offset < end && offset < range.offset + range.size) {
+      stages |= range.stageFlags;
+    }
+  }
+  toy::throwf(stages != 0, "no push constant range in [{}, {})", offset, end);
+  for (auto const& range : _pipeline->push_constant_ranges()) {
+    toy::throwf(
+      (range.stageFlags & stages) == 0 ||
+        (range.offset <= offset && end <= range.offset + range.size),
+      "the push constant range [{}, {}) is not covered by the stages {}",
+      offset,
+      end,
+      stages
+    );
+  }
+  vkCmdPushConstants(
+    _cmdbuf, _pipeline->pipeline_layout(), stages, offset, data.size(), data.data()
+  );
+}
+
 void RenderPass::recordDraw(
   VkCommandBuffer cmdbuf, Framebuffer& framebuffer, std::span<const VkClearValue> clear_values
 ) {
@@ -169,11 +293,17 @@ void RenderPass::recordDraw(
   // VK_SUBPASS_CONTENTS_INLINE: render pass的command被嵌入主缓冲区
   // VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS: render pass 命令
   // 将会从次缓冲区执行
+  // the commands out of render pass (such as compute dispatches) are recorded before it begins
+  for (auto& pending : _pipelines) {
+    if (auto& pipeline = pending.get(); pipeline.prepare) {
+      pipeline.prepare(cmdbuf);
+    }
+  }
   vkCmdBeginRenderPass(cmdbuf, &render_pass_begin_info, VK_SUBPASS_CONTENTS_INLINE);
-  for (auto& pipeline : _pipelines) {
-    auto recorder = Pipeline::Recorder{
-      cmdbuf, pipeline.pipeline(), pipeline.pipeline_layout(), framebuffer.extent()
-    };
+  auto bound_sets = Pipeline::Recorder::BoundDescriptorSets{};
+  for (auto& pending : _pipelines) {
+    auto& pipeline = pending.get();
+    auto  recorder = Pipeline::Recorder{ cmdbuf, pipeline, framebuffer.extent(), bound_sets };
     pipeline.recorder(recorder);
   }
   vkCmdEndRenderPass(cmdbuf);
@@ -0,0 +1,395 @@
+module render.vk.shader_reflection;
+
+import std;
+import toy;
+
+import "vulkan_config.h";
+
+namespace rd::vk {
+
+namespace spv {
+
+constexpr auto magic_number = uint32{ 0x07230203 };
+constexpr auto header_word_count = 5;
+
+enum Op : uint32 {
+  EntryPoint = 15,
+  TypeInt = 21,
+  TypeFloat = 22,
+  TypeVector = 23,
+  TypeMatrix = 24,
+  TypeImage = 25,
+  TypeSampler = 26,
+  TypeSampledImage = 27,
+  TypeArray = 28,
+  TypeRuntimeArray = 29,
+  TypeStruct = 30,
+  TypePointer = 32,
+  Constant = 43,
+  Variable = 59,
+  Decorate = 71,
+  MemberDecorate = 72,
+  TypeAccelerationStructure = 5341,
+};
+
+enum Decoration : uint32 {
+  Block = 2,
+  BufferBlock = 3,
+  ArrayStride = 6,
+  MatrixStride = 7,
+  BuiltIn = 11,
+  Location = 30,
+  Binding = 33,
+  DescriptorSet = 34,
+  Offset = 35,
+};
+
+enum StorageClass : uint32 {
+  UniformConstant = 0,
+  Input = 1,
+  Uniform = 2,
+  PushConstant = 9,
+  StorageBuffer = 12,
+};
+
+enum Dim : uint32 {
+  DimBuffer = 5,
+  DimSubpassData = 6,
+};
+
+} // namespace spv
+
+namespace {
+
+struct Decorations {
+  std::optional<uint32> set;
+  std::optional<uint32> binding;
+  std::optional<uint32> location;
+  std::optional<uint32> array_stride;
+  bool                  builtin = false;
+  bool                  block = false;
+  bool                  buffer_block = false;
+};
+
+struct MemberDecorations {
+  std::optional<uint32> offset;
+  std::optional<uint32> matrix_stride;
+};
+
+struct Type {
+  uint32 op;
+  // the operands after the result id
+  std::vector<uint32> operands;
+};
+
+struct Variable {
+  uint32 pointer_type;
+  uint32 id;
+  uint32 storage;
+};
+
+/**
+ * @brief the ids used by reflection, collected by one pass over the instructions
+ */
+struct Module {
+  std::optional<uint32>                                      execution_model;
+  std::unordered_map<uint32, Type>                           types;
+  std::unordered_map<uint32, uint32>                         constants;
+  std::unordered_map<uint32, Decorations>                    decorations;
+  std::unordered_map<uint32, std::vector<MemberDecorations>> member_decorations;
+  std::vector<Variable>                                      variables;
+
+  auto getType(uint32 id) const -> Type const& {
+    auto iter = types.find(id);
+    toy::throwf(iter != types.end(), "the type %{} is not found in SPIR-V", id);
+    return iter->second;
+  }
+  auto getDecorations(uint32 id) const -> Decorations {
+    auto iter = decorations.find(id);
+    return iter == decorations.end() ? Decorations{} : iter->second;
+  }
+  auto getMember(uint32 id, uint32 member) const -> MemberDecorations {
+    auto iter = member_decorations.find(id);
+    if (iter == member_decorations.end() || member >= iter->second.size()) {
+      return {};
+    }
+    return iter->second[member];
+  }
+
+  /**
+   * @brief the size of type in a block with explicit layout
+   */
+  auto getSize(uint32 id, std::optional<uint32> matrix_stride = std::nullopt) const -> uint32 {
+    auto& type = getType(id);
+    switch (type.op) {
+      case spv::TypeInt:
+      case spv::TypeFloat: return type.operands[0] / 8;
+      case spv::TypeVector: return getSize(type.operands[0]) * type.operands[1];
+      case spv::TypeMatrix:
+        return matrix_stride.value_or(getSize(type.operands[0])) * type.operands[1];
+      case spv::TypeArray: {
+        auto length = constants.at(type.operands[1]);
+        auto stride = getDecorations(id).array_stride;
+        return stride.value_or(getSize(type.operands[0])) * length;
+      }
+      case spv::TypeStruct: {
+        auto size = uint32{ 0 };
+        for (auto [index, member_type] : type.operands | toy::enumerate) {
+          auto member = getMember(id, index);
+          auto end = member.offset.value_or(0) + getSize(member_type, member.matrix_stride);
+          size = std::max(size, end);
+        }
+        return size;
+      }
+      default: toy::throwf("unsupported type op {} in block", type.op);
+    }
+    std::unreachable();
+  }
+
+  auto getFormat(uint32 id) const -> VkFormat {
+    auto& type = getType(id);
+    auto  component_count = uint32{ 1 };
+    auto* component = &type;
+    if (type.op == spv::TypeVector) {
+      component_count = type.operands[1];
+      component = &getType(type.operands[0]);
+    }
+    auto width = component->operands[0];
+    using Formats = std::array<VkFormat, 4>;
+    auto formats = Formats{};
+    if (component->op == spv::TypeFloat && width == 32) {
+      formats = Formats{ VK_FORMAT_R32_SFLOAT,
+                         VK_FORMAT_R32G32_SFLOAT,
+                         VK_FORMAT_R32G32B32_SFLOAT,
+                         VK_FORMAT_R32G32B32A32_SFLOAT };
+    } else if (component->op == spv::TypeFloat && width == 64) {
+      formats = Formats{ VK_FORMAT_R64_SFLOAT,
+                         VK_FORMAT_R64G64_SFLOAT,
+                         VK_FORMAT_R64G64B64_SFLOAT,
+                         VK_FORMAT_R64G64B64A64_SFLOAT };
+    } else if (component->op == spv::TypeInt && width == 32 && component->operands[1] == 1) {
+      formats = Formats{ VK_FORMAT_R32_SINT,
+                         VK_FORMAT_R32G32_SINT,
+                         VK_FORMAT_R32G32B32_SINT,
+                         VK_FORMAT_R32G32B32A32_SINT };
+    } else if (component->op == spv::TypeInt && width == 32) {
+      formats = Formats{ VK_FORMAT_R32_UINT,
+                         VK_FORMAT_R32G32_UINT,
+                         VK_FORMAT_R32G32B32_UINT,
+                         VK_FORMAT_R32G32B32A32_UINT };
+    } else {
+      return VK_FORMAT_UNDEFINED;
+    }
+    return formats[component_count - 1];
+  }
+
+  auto getDescriptorType(uint32 type_id, uint32 storage) const -> VkDescriptorType {
+    auto& type = getType(type_id);
+    switch (storage) {
+      case spv::UniformConstant:
+        switch (type.op) {
+          case spv::TypeSampledImage: return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+          case spv::TypeSampler: return VK_DESCRIPTOR_TYPE_SAMPLER;
+          case spv::TypeAccelerationStructure: return VK_DESCRIPTOR_TYPE_ACCELERATION_STRUCTURE_KHR;
+          case spv::TypeImage: {
+            // operands: sampled type, dim, depth, arrayed, ms, sampled, format
+            auto dim = type.operands[1];
+            auto sampled = type.operands[5] == 1;
+            if (dim == spv::DimSubpassData) {
+              return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+            } else if (dim == spv::DimBuffer) {
+              return sampled ? VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER
+                             : VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER;
+            }
+            return sampled ? VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+          }
+          default: break;
+        }
+        break;
+      case spv::Uniform:
+        // the storage buffer of old SPIR-V version is a Uniform with BufferBlock
+        return getDecorations(type_id).buffer_block ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+                                                    : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+      case spv::StorageBuffer: return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      default: break;
+    }
+    toy::throwf("unsupported descriptor of type op {} in storage class {}", type.op, storage);
+    std::unreachable();
+  }
+};
+
+auto parseModule(std::span<const uint32> code) -> Module {
+  toy::throwf(
+    code.size() >= spv::header_word_count && code[0] == spv::magic_number, "invalid SPIR-V"
+  );
+  auto spirv = Module{};
+  auto words = code.subspan(spv::header_word_count);
+  while (!words.empty()) {
+    auto word_count = words[0] >> 16;
+    auto op = words[0] & 0xffff;
+    toy::throwf(word_count != 0 && word_count <= words.size(), "invalid SPIR-V instruction");
+    auto operands = words.subspan(1, word_count - 1);
+    words = words.subspan(word_count);
+    switch (op) {
+      case spv::EntryPoint:
+        if (!spirv.execution_model.has_value()) {
+          spirv.execution_model = operands[0];
+        }
+        break;
+      case spv::TypeInt:
+      case spv::TypeFloat:
+      case spv::TypeVector:
+      case spv::TypeMatrix:
+      case spv::TypeImage:
+      case spv::TypeSampler:
+      case spv::TypeSampledImage:
+      case spv::TypeArray:
+      case spv::TypeRuntimeArray:
+      case spv::TypeStruct:
+      case spv::TypePointer:
+      case spv::TypeAccelerationStructure:
+        spirv.types[operands[0]] = Type{
+          .op = op,
+          .operands = operands.subspan(1) | ranges::to<std::vector>(),
+        };
+        break;
+      case spv::Constant:
+        // only the low word is used, as the length of array
+        spirv.constants[operands[1]] = operands[2];
+        break;
+      case spv::Variable:
+        spirv.variables.push_back({ operands[0], operands[1], operands[2] });
+        break;
+      case spv::Decorate: {
+        auto& decorations = spirv.decorations[operands[0]];
+        switch (operands[1]) {
+          case spv::DescriptorSet: decorations.set = operands[2]; break;
+          case spv::Binding: decorations.binding = operands[2]; break;
+          case spv::Location: decorations.location = operands[2]; break;
+          case spv::ArrayStride: decorations.array_stride = operands[2]; break;
+          case spv::BuiltIn: decorations.builtin = true; break;
+          case spv::Block: decorations.block = true; break;
+          case spv::BufferBlock: decorations.buffer_block = true; break;
+          default: break;
+        }
+        break;
+      }
+      case spv::MemberDecorate: {
+        auto& members = spirv.member_decorations[operands[0]];
+        if (members.size() <= operands[1]) {
+          members.resize(operands[1] + 1);
+        }
+        if (operands[2] == spv::Offset) {
+          members[operands[1]].offset = operands[3];
+        } else if (operands[2] == spv::MatrixStride) {
+          members[operands[1]].matrix_stride = operands[3];
+        }
+        break;
+      }
+      default: break;
+    }
+  }
+  toy::throwf(spirv.execution_model.has_value(), "the SPIR-V has no entry point");
+  return spirv;
+}
+
+auto getStage(uint32 execution_model) -> VkShaderStageFlagBits {
+  switch (execution_model) {
+    case 0: return VK_SHADER_STAGE_VERTEX_BIT;
+    case 1: return VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT;
+    case 2: return VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT;
+    case 3: return VK_SHADER_STAGE_GEOMETRY_BIT;
+    case 4: return VK_SHADER_STAGE_FRAGMENT_BIT;
+    case 5: return VK_SHADER_STAGE_COMPUTE_BIT;
+    default: toy::throwf("unsupported execution model {}", execution_model);
+  }
+  std::unreachable();
+}
+
+} // namespace
+
+auto reflectShader(std::span<const uint32> code) -> ShaderReflection {
+  auto spirv = parseModule(code);
+  auto reflection = ShaderReflection{ .stage = getStage(*spirv.execution_model) };
+  for (auto const& variable : spirv.variables) {
+    auto& pointer = spirv.getType(variable.pointer_type);
+    auto  type_id = pointer.operands[1];
+    auto  decorations = spirv.getDecorations(variable.id);
+    if (variable.storage == spv::PushConstant) {
+      auto& type = spirv.getType(type_id);
+      auto  offset = std::numeric_limits<uint32>::max();
+      for (auto index : views::iota(0u, type.operands.size())) {
+        offset = std::min(offset, spirv.getMember(type_id, index).offset.value_or(0));
+      }
+      reflection.push_constant = VkPushConstantRange{
+        .stageFlags = static_cast<VkShaderStageFlags>(reflection.stage),
+        .offset = offset,
+        .size = spirv.getSize(type_id) - offset,
+      };
+    } else if (variable.storage == spv::Input) {
+      if (reflection.stage != VK_SHADER_STAGE_VERTEX_BIT || decorations.builtin ||
+          !decorations.location.has_value()) {
+        continue;
+      }
+      reflection.inputs.push_back({ *decorations.location, spirv.getFormat(type_id) });
+    } else if (decorations.set.has_value() && decorations.binding.has_value()) {
+      auto count = uint32{ 1 };
+      if (auto& type = spirv.getType(type_id); type.op == spv::TypeArray) {
+        count = spirv.constants.at(type.operands[1]);
+        type_id = type.operands[0];
+      } else {
+        toy::throwf(type.op != spv::TypeRuntimeArray, "runtime descriptor array is not supported");
+      }
+      reflection.bindings.push_back(ReflectedBinding{
+        .set = *decorations.set,
+        .binding = *decorations.binding,
+        .type = spirv.getDescriptorType(type_id, variable.storage),
+        .count = count,
+        .stage = static_cast<VkShaderStageFlags>(reflection.stage),
+      });
+    }
+  }
+  ranges::sort(reflection.inputs, {}, &ReflectedInput::location);
+  return reflection;
+}
+
+auto mergeReflections(std::span<const ShaderReflection> reflections) -> PipelineReflection {
+  auto result = PipelineReflection{};
+  for (auto const& reflection : reflections) {
+    for (auto const& info : reflection.bindings) {
+      if (result.sets.size() <= info.set) {
+        result.sets.resize(info.set + 1);
+      }
+      auto& set = result.sets[info.set];
+      auto  iter = ranges::find(set, info.binding, &VkDescriptorSetLayoutBinding::binding);
+      if (iter == set.end()) {
+        set.push_back(VkDescriptorSetLayoutBinding{
+          .binding = info.binding,
+          .descriptorType = info.type,
+          .descriptorCount = info.count,
+          .stageFlags = info.stage,
+        });
+        continue;
+      }
+      toy::throwf(
+        iter->descriptorType == info.type && iter->descriptorCount == info.count,
+        "the binding {} of set {} is declared differently by shader stages",
+        info.binding,
+        info.set
+      );
+      iter->stageFlags |= info.stage;
+    }
+    if (reflection.push_constant.has_value()) {
+      result.push_constants.push_back(*reflection.push_constant);
+    }
+    if (reflection.stage == VK_SHADER_STAGE_VERTEX_BIT) {
+      result.vertex_inputs = reflection.inputs;
+    }
+  }
+  for (auto& set : result.sets) {
+    ranges::sort(set, {}, &VkDescriptorSetLayoutBinding::binding);
+  }
+  return result;
+}
+
+} // namespace rd::vk
@@ -60,27 +60,33 @@ auto Presentation::prepare() -> std::optional<Context> {
   auto previous_layout = ctx.tracker.getNowLayout();
   // submit barrier(s) to wait _acquire_ctx.available_sema
   // toy::debugf(toy::NoLocation{}, "prepare(): will call syncScope");
-  auto barrier = ctx.tracker.syncScope(
+  auto family = _present_executor->getFamily();
+  auto barriers = BarrierBatch{};
+  ctx.tracker.syncScope(
     Scope{ .stage_mask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT },
-    _present_executor->getFamily(),
-    VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+    family,
+    VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+    barriers
   );
-  if (auto* recorder = std::get_if<BarrierRecorder>(&barrier)) {
+  auto acquire_recorder = [&](VkCommandBuffer cmdbuf) { barriers.recordAcquire(cmdbuf, family); };
+  // only one image is synced, so there is at most one release family
+  if (auto release_families = barriers.getReleaseFamilies(); release_families.empty()) {
     auto batch = RawWaitCommandBatch{
-      .recorder = std::move(*recorder),
+      .recorder = acquire_recorder,
       .waits = { { _acquire_ctx.available_sema, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT } },
     };
     _present_executor->submit(batch);
-  } else if (auto* recorder = std::get_if<FamilyTransferRecorder>(&barrier)) {
+  } else {
+    auto release_family = release_families.front();
     auto release_batch = RawWaitCommandBatch{
-      .recorder = std::move(recorder->release),
+      .recorder = [&](VkCommandBuffer cmdbuf) { barriers.recordRelease(cmdbuf, release_family); },
       .waits = { { _acquire_ctx.available_sema, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT } },
     };
-    auto& release_executor = CommandExecutorManager::getInstance()[recorder->release_family];
+    auto& release_executor = CommandExecutorManager::getInstance()[release_family];
     auto  waitable = release_executor.submit(release_batch);
 
     auto acquire_batch = CommandBatch{
-      .recorder = std::move(recorder->acquire),
+      .recorder = acquire_recorder,
       .waits = { { &waitable, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT } },
     };
     _present_executor->submit(acquire_batch);
@@ -133,31 +139,37 @@ auto Presentation::present(uint32 image_index) -> bool {
     ctx.present_signal_fence.wait(true);
     ctx.fence_waitable = false;
   }
-  auto barrier = ctx.tracker.syncScope(
+  auto family = _present_executor->getFamily();
+  auto barriers = BarrierBatch{};
+  ctx.tracker.syncScope(
     Scope{ .stage_mask = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT },
-    _present_executor->getFamily(),
-    VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+    family,
+    VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+    barriers
   );
-  if (auto* recorder = std::get_if<BarrierRecorder>(&barrier)) {
+  auto acquire_recorder = [&](VkCommandBuffer cmdbuf) { barriers.recordAcquire(cmdbuf, family); };
+  if (auto release_families = barriers.getReleaseFamilies(); release_families.empty()) {
     auto batch = RawSignalCommandBatch{
-      .recorder = std::move(*recorder),
+      .recorder = acquire_recorder,
       .signals = { { wait_sema, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT } },
     };
     _present_executor->submit(batch);
-  } else if (auto* recorder = std::get_if<FamilyTransferRecorder>(&barrier)) {
-    auto& release_executor = CommandExecutorManager::getInstance()[recorder->release_family];
-    auto  release_batch = CommandBatch{
-       .recorder = std::move(recorder->release),
-    };
-    auto waitable = release_executor.submit(release_batch);
+  } else {
+    auto  release_family = release_families.front();
+    auto& release_executor = CommandExecutorManager::getInstance()[release_family];
+    auto  waitable = release_executor.submit([&](VkCommandBuffer cmdbuf) {
+      barriers.recordRelease(cmdbuf, release_family);
+    });
 
     auto acquire_batch = RawSignalCommandBatch{
-      .recorder = std::move(recorder->acquire),
+      .recorder = acquire_recorder,
       .waits = { { &waitable, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT } },
       .signals = { { wait_sema, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT } },
     };
     _present_executor->submit(acquire_batch);
   }
+  // the signal operation of wait_sema (binary semaphore) must be submitted before present
+  _present_executor->flush();
   auto result = vkPresent(image_index, wait_sema, signal_fence);
   // sema and fence is wait and signal in all result
   ctx.need_release = false;
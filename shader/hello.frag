@@ -5,7 +5,7 @@ layout(location = 0) in vec2 frag_tex_coord;
 
 layout(location = 0) out vec4 out_color;
 
-layout(set = 2, binding = 0) uniform sampler2D tex_sampler;
+layout(set = 1, binding = 0) uniform sampler2D tex_sampler;
 
 void main() {
   //out_color = vec4(frag_tex_coord, 0.0, 1.0);